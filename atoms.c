@@ -0,0 +1,72 @@
+/*
+ * Interning atoms from a table, all in one round trip.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#include "atoms.h"
+
+#ifdef DMALLOC
+#include "dmalloc.h"
+#endif
+
+int internatoms(xcb_connection_t *conn, const struct atomdef *atoms)
+{
+    xcb_intern_atom_cookie_t *cookies;
+    xcb_intern_atom_reply_t *rep;
+    int len;
+    int i;
+    int status = 0;
+
+    for (len = 0; NULL != atoms[len].name; len ++)
+    {
+        ;
+    }
+
+    if (NULL == (cookies = malloc(sizeof (xcb_intern_atom_cookie_t) * len)))
+    {
+        /* Fall back to asking one at a time. */
+        for (i = 0; i < len; i ++)
+        {
+            rep = xcb_intern_atom_reply(
+                conn, xcb_intern_atom(conn, 0, strlen(atoms[i].name),
+                                      atoms[i].name), NULL);
+            *atoms[i].atom = NULL != rep ? rep->atom : XCB_ATOM_NONE;
+            if (NULL == rep)
+            {
+                status = -1;
+            }
+            free(rep);
+        }
+
+        return status;
+    }
+
+    /* Send all requests first... */
+    for (i = 0; i < len; i ++)
+    {
+        cookies[i] = xcb_intern_atom(conn, 0, strlen(atoms[i].name),
+                                     atoms[i].name);
+    }
+
+    /* ...then collect the replies. */
+    for (i = 0; i < len; i ++)
+    {
+        rep = xcb_intern_atom_reply(conn, cookies[i], NULL);
+        if (NULL == rep)
+        {
+            fprintf(stderr, "Couldn't get atom %s.\n", atoms[i].name);
+            *atoms[i].atom = XCB_ATOM_NONE;
+            status = -1;
+            continue;
+        }
+
+        *atoms[i].atom = rep->atom;
+        free(rep);
+    }
+
+    free(cookies);
+
+    return status;
+}
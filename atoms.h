@@ -0,0 +1,19 @@
+/*
+ * An atom we want from the server and where to put it.
+ */
+struct atomdef
+{
+    const char *name;
+    xcb_atom_t *atom;
+};
+
+/*
+ * Intern all atoms in the table atoms, which ends with an entry with
+ * a NULL name. All requests go out before we wait for the first
+ * reply, so it costs one round trip however many atoms there are.
+ *
+ * Atoms we couldn't get are set to XCB_ATOM_NONE.
+ *
+ * Returns 0 if we got all of them, -1 otherwise.
+ */
+int internatoms(xcb_connection_t *conn, const struct atomdef *atoms);
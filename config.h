@@ -64,6 +64,27 @@
 /* Default snap margin in pixels. Used unless -s width. */
 #define SNAPMARGIN 0
 
+/*
+ * Move and resize an outline of the window instead of the window
+ * itself, and the window only when done. Set to true if you want this
+ * behaviour to be default. Can also be set by calling mcwm with -o.
+ */
+#define OUTLINE false
+
+/*
+ * Always move and resize windows with these WM_CLASS class names as
+ * an outline, for instance { "Firefox", "Gimp", NULL }. End the list
+ * with NULL.
+ */
+#define OUTLINECLASSES { NULL }
+
+/*
+ * Act on at most this many configure requests per second from every
+ * window. The rest are merged and handled in the next second. 0 means
+ * no limit. Used unless -r rate.
+ */
+#define CONFRATE 0
+
 /*
  * Keysym codes for window operations. Look in X11/keysymdefs.h for
  * actual symbols. Use XK_VoidSymbol to disable a function.
@@ -25,6 +25,7 @@
 #include <getopt.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_icccm.h>
+#include "atoms.h"
 
 xcb_connection_t *conn;
 xcb_screen_t *screen;
@@ -32,13 +33,18 @@ xcb_screen_t *screen;
 xcb_atom_t wm_state;
 xcb_atom_t wm_icon_name;
 
+const struct atomdef atoms[] =
+{
+    { "WM_STATE", &wm_state },
+    { NULL, NULL }
+};
+
 bool printcommand = false;
 
 static uint32_t get_wm_state(xcb_drawable_t win);
 static int findhidden(void);
 static void init(void);
 static void cleanup(void);
-static xcb_atom_t getatom(char *atom_name);
 static void printhelp(void);
 
 uint32_t get_wm_state(xcb_drawable_t win)
@@ -191,31 +197,6 @@ void cleanup(void)
     xcb_disconnect(conn);
 }
 
-/*
- * Get a defined atom from the X server.
- */
-xcb_atom_t getatom(char *atom_name)
-{
-    xcb_intern_atom_cookie_t atom_cookie;
-    xcb_atom_t atom;
-    xcb_intern_atom_reply_t *rep;
-
-    atom_cookie = xcb_intern_atom(conn, 0, strlen(atom_name), atom_name);
-    rep = xcb_intern_atom_reply(conn, atom_cookie, NULL);
-    if (NULL != rep)
-    {
-        atom = rep->atom;
-        free(rep);
-        return atom;
-    }
-
-    /*
-     * XXX Note that we return 0 as an atom if anything goes wrong.
-     * Might become interesting.
-     */
-    return 0;
-}
-
 void printhelp(void)
 {
     printf("hidden: Usage: hidden [-c]\n");
@@ -247,7 +228,7 @@ int main(int argc, char **argv)
     } /* while 1 */
 
     init();
-    wm_state = getatom("WM_STATE");
+    internatoms(conn, atoms);
     findhidden();
     cleanup();
     exit(0);
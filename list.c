@@ -55,6 +55,54 @@ void movetohead(struct item **mainlist, struct item *item)
     *mainlist = item;
 }
 
+/*
+ * Move element in item to just after element after in list mainlist,
+ * or to the head if after is NULL.
+ */
+void moveafter(struct item **mainlist, struct item *item,
+               struct item *after)
+{
+    if (NULL == after)
+    {
+        movetohead(mainlist, item);
+        return;
+    }
+
+    if (NULL == item || NULL == mainlist || NULL == *mainlist
+        || item == after || after->next == item)
+    {
+        /* Nowhere to go or already there. Do nothing. */
+        return;
+    }
+
+    /* Take us out of where we are now. */
+    if (*mainlist == item)
+    {
+        *mainlist = item->next;
+    }
+
+    if (NULL != item->prev)
+    {
+        item->prev->next = item->next;
+    }
+
+    if (NULL != item->next)
+    {
+        item->next->prev = item->prev;
+    }
+
+    /* And put us back in after after. */
+    item->prev = after;
+    item->next = after->next;
+
+    if (NULL != after->next)
+    {
+        after->next->prev = item;
+    }
+
+    after->next = item;
+}
+
 /*
  * Create space for a new item and add it to the head of mainlist.
  *
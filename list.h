@@ -10,6 +10,13 @@ struct item
  */
 void movetohead(struct item **mainlist, struct item *item);
 
+/*
+ * Move element in item to just after element after in list mainlist,
+ * or to the head if after is NULL.
+ */
+void moveafter(struct item **mainlist, struct item *item,
+               struct item *after);
+
 /*
  * Create space for a new item and add it to the head of mainlist.
  *
@@ -0,0 +1,609 @@
+/*
+ * The main loop of mcwm. Waits for file descriptors, signals and
+ * timers.
+ *
+ * On Linux we use epoll, with a signalfd for signals and a timerfd
+ * for timers, so everything we wait for is a file descriptor and
+ * nothing can slip in between checking for work and going to sleep.
+ *
+ * Elsewhere we fall back to select(). Signal handlers write to a pipe
+ * we watch and the timeout comes from the first timer.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_SIGNALFD_H) \
+    && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#else
+#include <sys/select.h>
+#endif
+
+#include "loop.h"
+
+#ifdef DMALLOC
+#include "dmalloc.h"
+#endif
+
+#ifdef DEBUG
+#define PDEBUG(Args...) \
+  do { fprintf(stderr, "mcwm: "); fprintf(stderr, ##Args); } while(0)
+#define D(x) x
+#else
+#define PDEBUG(Args...)
+#define D(x)
+#endif
+
+/* Most file descriptors we handle in one call to loopwait(). */
+#define MAXREADY 16
+
+/* A file descriptor we're watching. */
+struct source
+{
+    int fd;
+    loopfdfn_t fn;
+    void *data;
+    bool dead;                  /* Removed, free when it's safe. */
+    struct source *next;
+};
+
+/* A pending timer. */
+struct timer
+{
+    uint64_t expires;           /* Monotonic time in milliseconds. */
+    looptimerfn_t fn;
+    void *data;
+    struct timer *next;
+};
+
+/* What to call for a signal. */
+struct sighandler
+{
+    loopsigfn_t fn;
+    void *data;
+};
+
+static struct source *sources = NULL; /* All watched file descriptors. */
+static struct timer *timers = NULL;   /* Pending timers, first first. */
+static struct sighandler sighandlers[NSIG];
+static sigset_t sigs;                 /* Signals we handle. */
+
+#ifdef USE_EPOLL
+static int epfd = -1;           /* The epoll instance. */
+static int sigfd = -1;          /* Signals arrive here. */
+static int timerfd = -1;        /* Readable when first timer expires. */
+#else
+static int sigpipe[2] = { -1, -1 }; /* Signal handlers write here. */
+#endif
+
+static struct source *findsource(int fd);
+static void reapsources(void);
+static void runtimers(void);
+static void armtimer(void);
+static void readsignals(int fd, void *data);
+#ifdef USE_EPOLL
+static void readtimer(int fd, void *data);
+#else
+static void sigwrite(int sig);
+#endif
+
+uint64_t loopnow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void looptimers(void)
+{
+    /* Don't touch the timerfd unless something is actually due. */
+    if (NULL != timers && timers->expires <= loopnow())
+    {
+        runtimers();
+    }
+}
+
+struct source *findsource(int fd)
+{
+    struct source *src;
+
+    for (src = sources; src != NULL; src = src->next)
+    {
+        if (fd == src->fd && !src->dead)
+        {
+            return src;
+        }
+    }
+
+    return NULL;
+}
+
+/* Free sources removed while we were calling callbacks. */
+void reapsources(void)
+{
+    struct source **srcp;
+    struct source *src;
+
+    for (srcp = &sources; NULL != (src = *srcp);)
+    {
+        if (src->dead)
+        {
+            *srcp = src->next;
+            free(src);
+        }
+        else
+        {
+            srcp = &src->next;
+        }
+    }
+}
+
+/*
+ * Call the callbacks of all expired timers. A callback might add or
+ * delete timers, so we unlink each timer before calling it.
+ */
+void runtimers(void)
+{
+    struct timer *timer;
+    uint64_t t = loopnow();
+
+    while (NULL != timers && timers->expires <= t)
+    {
+        timer = timers;
+        timers = timer->next;
+
+        timer->fn(timer->data);
+        free(timer);
+    }
+
+    armtimer();
+}
+
+/* Make sure we wake up when the first timer expires. */
+void armtimer(void)
+{
+#ifdef USE_EPOLL
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if (NULL != timers)
+    {
+        its.it_value.tv_sec = timers->expires / 1000;
+        its.it_value.tv_nsec = (timers->expires % 1000) * 1000000;
+
+        /* Zero disarms the timer. Don't do that by mistake. */
+        if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec)
+        {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+    /* loopwait() computes the select() timeout from the list. */
+#endif
+}
+
+#ifdef USE_EPOLL
+
+/* One or more signals arrived on the signalfd. */
+void readsignals(int fd, void *data)
+{
+    struct signalfd_siginfo info;
+    int sig;
+
+    (void) data;
+
+    while (sizeof (info) == read(fd, &info, sizeof (info)))
+    {
+        sig = info.ssi_signo;
+        if (sig > 0 && sig < NSIG && NULL != sighandlers[sig].fn)
+        {
+            sighandlers[sig].fn(sig, sighandlers[sig].data);
+        }
+    }
+}
+
+/* The first timer expired. */
+void readtimer(int fd, void *data)
+{
+    uint64_t expirations;
+
+    (void) data;
+
+    /* Just empty it. We know what has expired from the list. */
+    if (-1 == read(fd, &expirations, sizeof (expirations)))
+    {
+        PDEBUG("Spurious timer wakeup.\n");
+    }
+
+    runtimers();
+}
+
+int loopinit(void)
+{
+    sigemptyset(&sigs);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == epfd)
+    {
+        perror("mcwm: epoll_create1");
+        return -1;
+    }
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (-1 == timerfd)
+    {
+        perror("mcwm: timerfd_create");
+        return -1;
+    }
+
+    return addfd(timerfd, readtimer, NULL);
+}
+
+int addfd(int fd, loopfdfn_t fn, void *data)
+{
+    struct source *src;
+    struct epoll_event ev;
+
+    if (NULL == (src = malloc(sizeof (struct source))))
+    {
+        return -1;
+    }
+
+    src->fd = fd;
+    src->fn = fn;
+    src->data = data;
+    src->dead = false;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = src;
+
+    if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        perror("mcwm: epoll_ctl");
+        free(src);
+        return -1;
+    }
+
+    src->next = sources;
+    sources = src;
+
+    return 0;
+}
+
+void delfd(int fd)
+{
+    struct source *src;
+
+    if (NULL == (src = findsource(fd)))
+    {
+        return;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    src->dead = true;
+}
+
+int addsignal(int sig, loopsigfn_t fn, void *data)
+{
+    bool first = (-1 == sigfd);
+
+    if (sig <= 0 || sig >= NSIG)
+    {
+        return -1;
+    }
+
+    sighandlers[sig].fn = fn;
+    sighandlers[sig].data = data;
+
+    /*
+     * Block the signal so it's only ever delivered through the
+     * signalfd. A signal arriving while we're busy just makes the fd
+     * readable, so we can't miss it.
+     */
+    sigaddset(&sigs, sig);
+    if (-1 == sigprocmask(SIG_BLOCK, &sigs, NULL))
+    {
+        perror("mcwm: sigprocmask");
+        return -1;
+    }
+
+    sigfd = signalfd(sigfd, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (-1 == sigfd)
+    {
+        perror("mcwm: signalfd");
+        return -1;
+    }
+
+    if (first)
+    {
+        return addfd(sigfd, readsignals, NULL);
+    }
+
+    return 0;
+}
+
+void loopchild(void)
+{
+    sigprocmask(SIG_UNBLOCK, &sigs, NULL);
+}
+
+int loopwait(void)
+{
+    struct epoll_event events[MAXREADY];
+    struct source *src;
+    int found;
+    int i;
+
+    found = epoll_wait(epfd, events, MAXREADY, -1);
+    if (-1 == found)
+    {
+        if (EINTR == errno)
+        {
+            return 0;
+        }
+
+        perror("mcwm: epoll_wait");
+        return -1;
+    }
+
+    for (i = 0; i < found; i ++)
+    {
+        src = events[i].data.ptr;
+        if (!src->dead && NULL != src->fn)
+        {
+            src->fn(src->fd, src->data);
+        }
+    }
+
+    reapsources();
+
+    return 0;
+}
+
+#else /* !USE_EPOLL */
+
+/* Signal handler. Just tell the loop. */
+void sigwrite(int sig)
+{
+    unsigned char c = sig;
+    int saved = errno;
+
+    if (-1 == write(sigpipe[1], &c, 1))
+    {
+        /* Pipe full. There's already a wakeup waiting. */
+    }
+
+    errno = saved;
+}
+
+/* One or more signals arrived through the pipe. */
+void readsignals(int fd, void *data)
+{
+    unsigned char c;
+
+    (void) data;
+
+    while (1 == read(fd, &c, 1))
+    {
+        if (c < NSIG && NULL != sighandlers[c].fn)
+        {
+            sighandlers[c].fn(c, sighandlers[c].data);
+        }
+    }
+}
+
+int loopinit(void)
+{
+    int i;
+
+    sigemptyset(&sigs);
+
+    if (-1 == pipe(sigpipe))
+    {
+        perror("mcwm: pipe");
+        return -1;
+    }
+
+    for (i = 0; i < 2; i ++)
+    {
+        fcntl(sigpipe[i], F_SETFL, fcntl(sigpipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return addfd(sigpipe[0], readsignals, NULL);
+}
+
+int addfd(int fd, loopfdfn_t fn, void *data)
+{
+    struct source *src;
+
+    if (fd >= FD_SETSIZE)
+    {
+        return -1;
+    }
+
+    if (NULL == (src = malloc(sizeof (struct source))))
+    {
+        return -1;
+    }
+
+    src->fd = fd;
+    src->fn = fn;
+    src->data = data;
+    src->dead = false;
+    src->next = sources;
+    sources = src;
+
+    return 0;
+}
+
+void delfd(int fd)
+{
+    struct source *src;
+
+    if (NULL != (src = findsource(fd)))
+    {
+        src->dead = true;
+    }
+}
+
+int addsignal(int sig, loopsigfn_t fn, void *data)
+{
+    struct sigaction sa;
+
+    if (sig <= 0 || sig >= NSIG || sig > 255)
+    {
+        return -1;
+    }
+
+    sighandlers[sig].fn = fn;
+    sighandlers[sig].data = data;
+    sigaddset(&sigs, sig);
+
+    sa.sa_handler = sigwrite;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    if (-1 == sigaction(sig, &sa, NULL))
+    {
+        perror("mcwm: sigaction");
+        return -1;
+    }
+
+    return 0;
+}
+
+void loopchild(void)
+{
+    /* exec() resets our handlers. Nothing to do. */
+}
+
+int loopwait(void)
+{
+    fd_set in;
+    struct timeval tv;
+    struct timeval *timeout = NULL;
+    struct source *src;
+    int maxfd = -1;
+    int found;
+    uint64_t t;
+
+    FD_ZERO(&in);
+    for (src = sources; src != NULL; src = src->next)
+    {
+        if (!src->dead)
+        {
+            FD_SET(src->fd, &in);
+            if (src->fd > maxfd)
+            {
+                maxfd = src->fd;
+            }
+        }
+    }
+
+    if (NULL != timers)
+    {
+        t = loopnow();
+        if (timers->expires > t)
+        {
+            t = timers->expires - t;
+        }
+        else
+        {
+            t = 0;
+        }
+
+        tv.tv_sec = t / 1000;
+        tv.tv_usec = (t % 1000) * 1000;
+        timeout = &tv;
+    }
+
+    found = select(maxfd + 1, &in, NULL, NULL, timeout);
+    if (-1 == found)
+    {
+        if (EINTR == errno)
+        {
+            /* The signal is waiting in the pipe. */
+            return 0;
+        }
+
+        perror("mcwm: select");
+        return -1;
+    }
+
+    for (src = sources; src != NULL; src = src->next)
+    {
+        if (!src->dead && FD_ISSET(src->fd, &in) && NULL != src->fn)
+        {
+            src->fn(src->fd, src->data);
+        }
+    }
+
+    reapsources();
+    runtimers();
+
+    return 0;
+}
+
+#endif /* USE_EPOLL */
+
+struct timer *addtimer(unsigned msec, looptimerfn_t fn, void *data)
+{
+    struct timer *timer;
+    struct timer **tp;
+
+    if (NULL == (timer = malloc(sizeof (struct timer))))
+    {
+        return NULL;
+    }
+
+    timer->expires = loopnow() + msec;
+    timer->fn = fn;
+    timer->data = data;
+
+    /* Keep the list sorted, first to expire first. */
+    for (tp = &timers; NULL != *tp && (*tp)->expires <= timer->expires;
+         tp = &(*tp)->next)
+    {
+        ;
+    }
+
+    timer->next = *tp;
+    *tp = timer;
+
+    if (timers == timer)
+    {
+        armtimer();
+    }
+
+    return timer;
+}
+
+void deltimer(struct timer *timer)
+{
+    struct timer **tp;
+
+    for (tp = &timers; NULL != *tp; tp = &(*tp)->next)
+    {
+        if (*tp == timer)
+        {
+            *tp = timer->next;
+            free(timer);
+            armtimer();
+            return;
+        }
+    }
+}
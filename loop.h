@@ -0,0 +1,76 @@
+/* Called when fd gets readable. */
+typedef void (*loopfdfn_t)(int fd, void *data);
+
+/* Called when signal sig has arrived. */
+typedef void (*loopsigfn_t)(int sig, void *data);
+
+/* Called when a timer expires. */
+typedef void (*looptimerfn_t)(void *data);
+
+struct timer;
+
+/*
+ * Set up the event loop. Must be called before anything else here.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int loopinit(void);
+
+/*
+ * Call fn with data every time fd is readable. fn may be NULL if we
+ * just want loopwait() to return.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int addfd(int fd, loopfdfn_t fn, void *data);
+
+/*
+ * Stop watching fd.
+ */
+void delfd(int fd);
+
+/*
+ * Call fn with data from the loop, not from a signal handler, when
+ * signal sig arrives.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int addsignal(int sig, loopsigfn_t fn, void *data);
+
+/*
+ * Call fn with data once, in msec milliseconds.
+ *
+ * Returns the new timer or NULL if out of memory.
+ */
+struct timer *addtimer(unsigned msec, looptimerfn_t fn, void *data);
+
+/*
+ * Cancel a timer that hasn't expired yet.
+ */
+void deltimer(struct timer *timer);
+
+/*
+ * Returns the current monotonic time in milliseconds, the same clock
+ * timers use.
+ */
+uint64_t loopnow(void);
+
+/*
+ * Call the callbacks of timers that have expired, without waiting.
+ * For callers that are too busy to get to loopwait() for a while.
+ */
+void looptimers(void);
+
+/*
+ * Undo what the loop did to signal handling. Call in a child process
+ * after fork().
+ */
+void loopchild(void);
+
+/*
+ * Wait until at least one file descriptor is readable, a signal
+ * arrives or a timer expires. Then call the callbacks.
+ *
+ * Returns 0 on success, -1 on errors.
+ */
+int loopwait(void);
@@ -32,13 +32,15 @@
 #include <string.h>
 #include <signal.h>
 #include <assert.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/wait.h>
-#include <sys/select.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/randr.h>
+#include <xcb/sync.h>
 #include <xcb/xcb_keysyms.h>
 #include <xcb/xcb_atom.h>
 #include <xcb/xcb_icccm.h>
@@ -48,11 +50,12 @@
 #include <xcb/xproto.h>
 #include <xcb/xcb_util.h>
 
-#ifdef DEBUG
 #include "events.h"
-#endif
 
 #include "list.h"
+#include "loop.h"
+#include "atoms.h"
+#include "rgb.h"
 
 /* Check here for user configurable parts: */
 #include "config.h"
@@ -85,6 +88,41 @@
  */
 #define MCWM_TABBING 4
 
+/* Maximum number of events we read from the server before handling them. */
+#define EVRING_SIZE 256
+
+/* How often we check our idea of window geometry in debug mode, in ms. */
+#define VERIFY_INTERVAL 10000
+
+/*
+ * Refresh rate we pace window moves and resizes to when we don't know
+ * the monitor's, in millihertz.
+ */
+#define DEFAULT_REFRESH 60000
+
+/*
+ * How long we wait for a client to catch up with a new size during
+ * interactive resize before we stop waiting for it, in ms.
+ */
+#define SYNC_TIMEOUT 250
+
+/*
+ * How long we keep fetching properties for a new top level window
+ * that doesn't ask to be mapped, in ms. Many never are, like client
+ * leaders.
+ */
+#define ADOPT_TIMEOUT 2000
+
+/* A border width no window has, for when we don't know it. */
+#define BORDER_UNKNOWN 0xffff
+
+/*
+ * Number of our own requests whose echoes we remember. Must be a
+ * power of two. If we send more requests than this before the events
+ * come back, we just handle the events as usual.
+ */
+#define ECHO_SIZE 256
+
 /* Number of workspaces. */
 #define WORKSPACES 10
 
@@ -135,12 +173,14 @@ typedef enum {
 
 struct monitor
 {
-    xcb_randr_output_t id;
+    xcb_randr_output_t id;      /* Output, or name atom if randrmon. */
+    bool randrmon;              /* From RANDR 1.5 monitors, not outputs? */
     char *name;
     int16_t x;                 /* X and Y. */
     int16_t y;
     uint16_t width;     /* Width in pixels. */
     uint16_t height;    /* Height in pixels. */
+    uint32_t refresh;   /* Refresh rate in millihertz, 0 if unknown. */
     struct item *item; /* Pointer to our place in output list. */
 };
 
@@ -152,6 +192,77 @@ struct sizepos
     uint16_t height;
 };
 
+/*
+ * Properties of a window we fetch ahead of time so we don't have to
+ * wait for the server when we need them. Kept up to date through
+ * PropertyNotify. The strings are NULL if the property isn't set.
+ */
+struct props
+{
+    bool gothints;              /* Did we get WM_NORMAL_HINTS? */
+    xcb_size_hints_t hints;
+    bool gotwmhints;            /* Did we get WM_HINTS? */
+    xcb_icccm_wm_hints_t wmhints;
+    uint32_t desktop;           /* _NET_WM_DESKTOP or MCWM_NOWS. */
+    bool deletewindow;          /* WM_PROTOCOLS has WM_DELETE_WINDOW. */
+    bool syncrequest;           /* WM_PROTOCOLS has _NET_WM_SYNC_REQUEST. */
+    xcb_sync_counter_t synccounter; /* _NET_WM_SYNC_REQUEST_COUNTER. */
+    xcb_window_t transient;     /* WM_TRANSIENT_FOR or XCB_NONE. */
+    char *instance;             /* WM_CLASS instance name. */
+    char *wmclass;              /* WM_CLASS class name. */
+    char *name;                 /* WM_NAME. */
+    char *iconname;             /* WM_ICON_NAME. */
+};
+
+/*
+ * Where we are in the _NET_WM_SYNC_REQUEST protocol with a client.
+ * We send a new size only when the client has updated its counter
+ * for the last one.
+ */
+struct sync
+{
+    xcb_sync_counter_t counter; /* The counter we're watching. */
+    bool known;                 /* Do we know the counter's value? */
+    int64_t value;              /* Last value we asked the client for. */
+    xcb_sync_alarm_t alarm;     /* Tells us when the counter gets there. */
+    bool waiting;               /* Waiting for the client to catch up? */
+    bool unresponsive;          /* Timed out. Don't wait until it answers. */
+    struct timer *timer;        /* Timeout while waiting. */
+    int held[4];                /* Resize steps from the keyboard held back
+                                 * while waiting, for h, j, k and l. */
+};
+
+/*
+ * How many configure requests a client has sent us lately. Requests
+ * over the limit are merged into one we act on later.
+ */
+struct flood
+{
+    uint64_t start;             /* When this second began. See loopnow(). */
+    unsigned count;             /* Requests this second. */
+    uint64_t total;             /* Requests ever. */
+    uint64_t held;              /* Requests we held back. */
+    bool pending;               /* Is there a held back request? */
+    xcb_configure_request_event_t request; /* All held back, merged. */
+    struct timer *timer;        /* Start of next second. */
+};
+
+/*
+ * Geometry and stacking changes for a client we haven't sent yet. At
+ * the end of every turn of the event loop they go out in one
+ * configure per client.
+ */
+struct stage
+{
+    uint16_t dirty;             /* XCB_CONFIG_WINDOW_* to send. */
+    xcb_window_t sibling;       /* Sibling, if dirty. */
+    uint8_t stackmode;          /* Stack mode, if dirty. */
+    bool notify;                /* Client asked. Tell it even if nothing
+                                 * changes. */
+    bool sync;                  /* Interactive resize. Ask the client to
+                                 * sync up if the size changes. */
+};
+
 /* Everything we know about a window. */
 struct client
 {
@@ -169,12 +280,121 @@ struct client
     bool vertmaxed;             /* Vertically maximized? */
     bool maxed;                 /* Totally maximized? */
     bool fixed;           /* Visible on all workspaces? */
+    unsigned int lastconfigure; /* Sequence number of our last configure. */
+    struct props props;         /* Cached properties. */
+    struct sync sync;           /* Resize synchronization. */
+    struct flood flood;         /* Configure requests from the client. */
+    struct stage stage;         /* Changes not yet sent. */
+    struct sizepos sent;        /* Geometry we last sent or heard of. */
+    uint16_t sentborder;        /* Ditto for the border. BORDER_UNKNOWN
+                                 * if we don't know. */
+    uint16_t borderwidth;       /* Border width it has or will have. */
+    bool haspixel;              /* Did we set the border colour? */
+    uint32_t borderpixel;       /* The border colour we set. */
     struct monitor *monitor;    /* The physical output this window is on. */
     struct item *winitem; /* Pointer to our place in global windows list. */
     struct item *wsitem[WORKSPACES]; /* Pointer to our place in every
                                              * workspace window list. */
 };
 
+/*
+ * Events read from the server but not yet handled. Superseded events
+ * are freed and their slots set to NULL before we get to them.
+ */
+struct evring
+{
+    xcb_generic_event_t *ev[EVRING_SIZE];
+    unsigned repeats[EVRING_SIZE]; /* Key repeats merged into a key press. */
+    unsigned head;              /* Oldest event. */
+    unsigned len;               /* Number of slots in use. */
+};
+
+/*
+ * Called when the reply to a request arrives. If the request failed,
+ * reply is NULL and error says why. The caller frees both.
+ */
+typedef void (*replyfn_t)(void *reply, xcb_generic_error_t *error,
+                          void *data);
+
+/* A request we're waiting for a reply to. */
+struct waitreply
+{
+    unsigned int sequence;      /* Sequence number of the request. */
+    replyfn_t fn;               /* What to call with the reply. */
+    void *data;                 /* Passed along to fn. */
+    struct waitreply *next;
+};
+
+/*
+ * A top level window we will probably have to manage soon. We start
+ * collecting what setupwin() needs when the window is created, so
+ * it's usually all here when it asks to be mapped.
+ */
+struct adopt
+{
+    xcb_window_t id;            /* ID of this window. */
+    bool mapped;                /* Has it asked to be mapped? */
+    int waiting;                /* Number of replies still outstanding. */
+    bool gotgeom;               /* Do we know the geometry? */
+    struct sizepos geom;
+    struct props props;         /* Properties, kept up to date. */
+    bool gotpointer;            /* Did we get the pointer position? */
+    int16_t pointx;
+    int16_t pointy;
+    struct timer *timer;        /* Gives up on it if it's never mapped. */
+    struct item *item;          /* Our place in the adoption list. */
+};
+
+/*
+ * A notification we expect the server to send us because of one of
+ * our own requests. Indexed by the sequence number of the request.
+ */
+struct echo
+{
+    unsigned int sequence;      /* Sequence number of our request. */
+    uint8_t type;               /* The event it generates. */
+    xcb_window_t win;           /* The window the event is about. */
+};
+
+/* Where we think the pointer is, from events and our own warps. */
+struct pointerpos
+{
+    bool known;                 /* Do we know anything at all? */
+    bool current;               /* Still true for the event we're handling? */
+    int16_t x;                  /* Root coordinates. */
+    int16_t y;
+    unsigned int sequence;      /* Events older than this request are stale. */
+};
+
+/*
+ * The latest pointer position while moving or resizing with the
+ * mouse, not yet applied to the window.
+ */
+struct drag
+{
+    bool pending;               /* Is there anything to apply? */
+    int16_t x;                  /* Root coordinates. */
+    int16_t y;
+    uint64_t when;              /* Oldest motion not applied, in us. */
+    uint64_t start;             /* When we started dragging, in us. */
+    uint64_t last;              /* When we last moved the window, in us. */
+    struct timer *timer;        /* Next frame, if we're waiting for it. */
+    bool outline;               /* Only moving an outline around? */
+    bool shown;                 /* Is the outline on screen? */
+    xcb_rectangle_t rect;       /* Where the outline is drawn. */
+};
+
+/*
+ * A child of the root in our model of the stacking order. Unmapped
+ * windows can't hide anything, but they keep their place.
+ */
+struct stackwin
+{
+    xcb_window_t id;
+    bool mapped;
+    struct item *item;          /* Our place in the stacking list. */
+};
+
 /* Window configuration data. */
 struct winconf
 {
@@ -190,11 +410,26 @@ struct winconf
 
 /* Globals */
 
+struct evring evring;           /* Events waiting to be handled. */
+struct echo echoes[ECHO_SIZE];  /* Events caused by our own requests. */
+struct pointerpos pointerpos;   /* Last known pointer position. */
+struct drag drag;               /* Where we're dragging a window. */
+#ifdef DEBUG
+unsigned int verifyseq;         /* First request of the last geometry check. */
+#endif
+
 int sigcode;                    /* Signal code. Non-zero if we've been
                                  * interruped by a signal. */
 xcb_connection_t *conn;         /* Connection to X server. */
 xcb_screen_t *screen;           /* Our current screen.  */
+xcb_visualtype_t *visual;       /* Visual of the root window. */
 int randrbase;                  /* Beginning of RANDR extension events. */
+bool randrmonitors = false;     /* Does RANDR 1.5 tell us about monitors? */
+int syncbase;                   /* Beginning of SYNC extension events. */
+unsigned keyrepeats;            /* Repeats merged into this key press. */
+bool geomdirty;                 /* Does any client have staged changes? */
+struct item *stacklist = NULL;  /* Children of root, topmost first. */
+xcb_gcontext_t outlinegc;       /* Draws outlines by inverting the root. */
 uint32_t curws = 0;             /* Current workspace. */
 struct client *focuswin;        /* Current focus window. */
 struct client *lastfocuswin;        /* Last focused window. NOTE! Only
@@ -203,7 +438,12 @@ struct client *lastfocuswin;        /* Last focused window. NOTE! Only
                                      * mode. */
 struct item *winlist = NULL;    /* Global list of all client windows. */
 struct item *monlist = NULL;    /* List of all physical monitor outputs. */
+struct item *adoptlist = NULL;  /* Windows we'll probably manage. */
+struct waitreply *replyhead = NULL; /* Requests waiting for replies, */
+struct waitreply *replytail = NULL; /* oldest first. */
 int mode = 0;                   /* Internal mode, such as move or resize */
+int16_t mode_x = 0;             /* X coord when in special mode */
+int16_t mode_y = 0;             /* Y coord when in special mode */
 
 /*
  * Workspace list: Every workspace has a list of all visible
@@ -284,8 +524,61 @@ struct conf
     uint32_t unfocuscol;        /* Unfocused border colour.  */
     uint32_t fixedcol;          /* Fixed windows border colour. */
     bool allowicons;            /* Allow windows to be unmapped. */
+    bool stats;                 /* Print statistics when exiting. */
+    bool directmotion;          /* Drag using motion events, not hints. */
+    bool outline;               /* Move and resize as an outline. */
+    unsigned confrate;          /* Configure requests per second per
+                                 * window, 0 for no limit. */
 } conf;
 
+/* Counters for profiling. Printed on exit if started with -S. */
+struct stats
+{
+    uint64_t startup;           /* Microseconds adopting windows. */
+    uint64_t adopted;           /* Windows we found when we started. */
+    uint64_t events;            /* Events handled. */
+    uint64_t flushes;           /* Request buffer written to server. */
+    uint64_t coalesced;         /* Events dropped as superseded. */
+    uint64_t keyrepeats;        /* Key repeats merged into a later press. */
+    uint64_t confrequests;      /* Configure requests from clients. */
+    uint64_t confheld;          /* Ones held back by the rate limit. */
+    uint64_t flooders;          /* Windows that hit the rate limit. */
+    uint64_t commits;           /* Configures sent for staged changes. */
+    uint64_t commitvalues;      /* Values in them. */
+    uint64_t commitskipped;     /* Staged values the server already had. */
+    uint64_t borderskipped;     /* Border changes to what it already was. */
+    uint64_t restacks;          /* Stacking changes we sent. */
+    uint64_t restackskipped;    /* Ones that wouldn't change anything. */
+    uint64_t replies;           /* Replies handled asynchronously. */
+    uint64_t echoes;            /* Our own events dropped unhandled. */
+    uint64_t stale;             /* Events for windows already destroyed. */
+    uint64_t prefetched;        /* New windows with all properties ready. */
+    uint64_t adoptexpired;      /* New windows that were never mapped. */
+    uint64_t pointerhits;       /* Pointer positions we knew from events. */
+    uint64_t pointerqueries;    /* Pointer positions we had to ask for. */
+    uint64_t syncrequests;      /* Sizes we asked clients to sync up to. */
+    uint64_t synctimeouts;      /* Clients that didn't catch up in time. */
+    uint64_t syncheld;          /* Resizes held back waiting for clients. */
+    uint64_t dragupdates;       /* Window moves and resizes while dragging. */
+    uint64_t draglatency;       /* Total microseconds from motion to update. */
+    uint64_t dragtime;          /* Total microseconds spent dragging. */
+} stats;
+
+/* Handles one type of event. */
+typedef void (*handlerfn_t)(xcb_generic_event_t *ev);
+
+/*
+ * Event handlers, indexed by response type. Extensions register
+ * handlers at their first_event offset.
+ */
+struct handler
+{
+    handlerfn_t fn;
+    const char *name;
+    uint64_t count;             /* Events of this type we got. */
+    uint64_t nsec;              /* Time spent handling them. */
+} handlers[256];
+
 xcb_atom_t atom_desktop;        /*
                                  * EWMH _NET_WM_DESKTOP hint that says
                                  * what workspace a window should be
@@ -296,6 +589,28 @@ xcb_atom_t wm_delete_window;    /* WM_DELETE_WINDOW event to close windows.  */
 xcb_atom_t wm_change_state;
 xcb_atom_t wm_state;
 xcb_atom_t wm_protocols;        /* WM_PROTOCOLS.  */
+xcb_atom_t net_wm_sync_request; /* _NET_WM_SYNC_REQUEST protocol. */
+xcb_atom_t net_wm_sync_request_counter; /* Its counter property. */
+
+/* A colour we want and where to put its pixel value. */
+struct colordef
+{
+    const char *name;
+    uint32_t *pixel;
+};
+
+/* All atoms we need, interned at once when we start. */
+const struct atomdef atoms[] =
+{
+    { "_NET_WM_DESKTOP", &atom_desktop },
+    { "WM_DELETE_WINDOW", &wm_delete_window },
+    { "WM_CHANGE_STATE", &wm_change_state },
+    { "WM_STATE", &wm_state },
+    { "WM_PROTOCOLS", &wm_protocols },
+    { "_NET_WM_SYNC_REQUEST", &net_wm_sync_request },
+    { "_NET_WM_SYNC_REQUEST_COUNTER", &net_wm_sync_request_counter },
+    { NULL, NULL }
+};
 
 
 /* Functions declerations. */
@@ -305,27 +620,80 @@ static struct modkeycodes getmodkeys(xcb_mod_mask_t modmask);
 static void cleanup(int code);
 static void arrangewindows(void);
 static void setwmdesktop(xcb_drawable_t win, uint32_t ws);
-static int32_t getwmdesktop(xcb_drawable_t win);
+static uint32_t desktopfromreply(xcb_get_property_reply_t *reply);
 static void addtoworkspace(struct client *client, uint32_t ws);
 static void delfromworkspace(struct client *client, uint32_t ws);
 static void changeworkspace(uint32_t ws);
 static void fixwindow(struct client *client, bool setcolour);
-static uint32_t getcolor(const char *colstr);
+static xcb_visualtype_t *findvisual(xcb_visualid_t id);
+static bool parsecolor(const char *colstr, uint16_t *red, uint16_t *green,
+                       uint16_t *blue);
+static uint32_t scalecolor(uint16_t value, uint32_t mask);
+static void getcolors(const struct colordef *colors);
 static void forgetclient(struct client *client);
 static void forgetwin(xcb_window_t win);
 static void fitonscreen(struct client *client);
 static void newwin(xcb_window_t win);
-static struct client *setupwin(xcb_window_t win);
+static struct adopt *newadopt(xcb_window_t win);
+static struct adopt *findadopt(xcb_window_t win);
+static void forgetadopt(xcb_window_t win);
+static struct props *findprops(xcb_window_t win);
+static void initprops(struct props *props);
+static void freeprops(struct props *props);
+static void fetchprops(xcb_window_t win);
+static bool fetchprop(xcb_window_t win, xcb_atom_t atom);
+static char *propstring(xcb_get_property_reply_t *reply);
+static void propdone(xcb_window_t win);
+static void hintsreply(void *reply, xcb_generic_error_t *error, void *data);
+static void desktopreply(void *reply, xcb_generic_error_t *error,
+                         void *data);
+static void protocolsreply(void *reply, xcb_generic_error_t *error,
+                           void *data);
+static void transientreply(void *reply, xcb_generic_error_t *error,
+                           void *data);
+static void wmhintsreply(void *reply, xcb_generic_error_t *error,
+                         void *data);
+static void classreply(void *reply, xcb_generic_error_t *error, void *data);
+static void synccounterreply(void *reply, xcb_generic_error_t *error,
+                             void *data);
+static void namereply(void *reply, xcb_generic_error_t *error, void *data);
+static void iconnamereply(void *reply, xcb_generic_error_t *error,
+                          void *data);
+static void adoptgeomreply(void *reply, xcb_generic_error_t *error,
+                           void *data);
+static void adoptpointerreply(void *reply, xcb_generic_error_t *error,
+                              void *data);
+static void adoptdone(struct adopt *adopt);
+static void adopttimeout(void *data);
+static void applyhints(struct client *client);
+static struct client *setupwin(xcb_window_t win, const struct sizepos *geom,
+                               const xcb_size_hints_t *hints);
 static xcb_keycode_t keysymtokeycode(xcb_keysym_t keysym,
                                      xcb_key_symbols_t *keysyms);
 static int setupkeys(void);
 static int setupscreen(void);
 static int setuprandr(void);
+static int setupsync(void);
+static void resetsync(struct client *client);
+static void freesync(struct client *client);
+static void counterreply(void *reply, xcb_generic_error_t *error, void *data);
+static bool syncwaiting(struct client *client);
+static void syncrequest(struct client *client);
+static void synctimeout(void *data);
+static void replaysteps(struct client *client);
+static bool ratelimit(struct client *client,
+                      xcb_configure_request_event_t *e);
+static void floodtimeout(void *data);
+static void freeflood(struct client *client);
 static void getrandr(void);
+static uint32_t moderefresh(xcb_randr_mode_t id, xcb_randr_mode_info_t *modes,
+                            int nmodes);
 static void getoutputs(xcb_randr_output_t *outputs, int len,
+                       xcb_randr_mode_info_t *modes, int nmodes,
                        xcb_timestamp_t timestamp);
 void arrbymon(struct monitor *monitor);
-static struct monitor *findmonitor(xcb_randr_output_t id);
+static struct monitor *findmonitor(xcb_randr_output_t id, bool randrmon);
+static void dropothers(bool randrmon);
 static struct monitor *findclones(xcb_randr_output_t id, int16_t x, int16_t y);
 static struct monitor *findmonbycoord(int16_t x, int16_t y);
 static void delmonitor(struct monitor *mon);
@@ -338,26 +706,30 @@ static void movelim(struct client *client);
 static void movewindow(xcb_drawable_t win, uint16_t x, uint16_t y);
 static struct client *findclient(xcb_drawable_t win);
 static void focusnext(bool reverse);
-static void setunfocus(xcb_drawable_t win);
+static void setunfocus(struct client *client);
+static void setborderpixel(struct client *client, uint32_t pixel);
 static void setfocus(struct client *client);
 static int start(char *program);
 static void resizelim(struct client *client);
 static void moveresize(xcb_drawable_t win, uint16_t x, uint16_t y,
                        uint16_t width, uint16_t height);
 static void resize(xcb_drawable_t win, uint16_t width, uint16_t height);
-static void resizestep(struct client *client, char direction);
+static void resizestep(struct client *client, char direction, int steps);
 static void snapwindow(struct client *client, int snap_mode);
 static void mousemove(struct client *client, int rel_x, int rel_y);
 static void mouseresize(struct client *client, int rel_x, int rel_y);
-static void movestep(struct client *client, char direction);
+static void movestep(struct client *client, char direction, int steps);
 static void setborders(struct client *client, int width);
 static void unmax(struct client *client);
 static void maximize(struct client *client);
 static void maxvert(struct client *client);
 static void hide(struct client *client);
-static bool getpointer(xcb_drawable_t win, int16_t *x, int16_t *y);
-static bool getgeom(xcb_drawable_t win, int16_t *x, int16_t *y, uint16_t *width,
-                    uint16_t *height);
+static void trackpointer(xcb_generic_event_t *ev);
+static bool pointerfresh(void);
+static void setpointer(int16_t x, int16_t y, unsigned int sequence);
+static bool getpointer(const struct client *client, int16_t *x, int16_t *y);
+static void initpointerreply(void *reply, xcb_generic_error_t *error,
+                             void *data);
 static void topleft(void);
 static void topright(void);
 static void botleft(void);
@@ -365,13 +737,88 @@ static void botright(void);
 static void deletewin(void);
 static void prevscreen(void);
 static void nextscreen(void);
-static void handle_keypress(xcb_key_press_event_t *ev);
+static void handle_keypress(xcb_generic_event_t *event);
 static void configwin(xcb_window_t win, uint16_t mask, struct winconf wc);
 static void configurerequest(xcb_configure_request_event_t *e);
+static void handle_configurerequest(xcb_generic_event_t *ev);
+static void motionreply(void *reply, xcb_generic_error_t *error, void *data);
+static uint64_t microseconds(void);
+static uint64_t frameinterval(int16_t x, int16_t y);
+static void applydrag(void);
+static void dragframe(void *data);
+static void flushdrag(void);
+static bool outlineclass(const struct client *client);
+static bool outlining(const struct client *client);
+static void setupoutline(void);
+static void showoutline(const struct client *client);
+static void hideoutline(void);
+static void expectreply(unsigned int sequence, replyfn_t fn, void *data);
+static void expectecho(unsigned int sequence, uint8_t type,
+                       xcb_window_t win);
+static bool isecho(xcb_generic_event_t *ev);
+static void stagegeom(struct client *client, uint16_t mask);
+static void stageborder(struct client *client, uint16_t width);
+static void stagestack(struct client *client, uint8_t stackmode,
+                       xcb_window_t sibling);
+static void commitgeom(struct client *client);
+static void commitall(void);
+static struct stackwin *findstack(xcb_window_t win);
+static struct stackwin *addstack(xcb_window_t win);
+static void delstack(xcb_window_t win);
+static void restack(xcb_window_t win, uint8_t stackmode,
+                    xcb_window_t sibling);
+static bool stacknoop(xcb_window_t win, uint8_t stackmode,
+                      xcb_window_t sibling);
+static void trackstack(xcb_generic_event_t *ev);
+static void sendconfnotify(struct client *client);
+static unsigned int configurewin(xcb_window_t win, uint16_t mask,
+                                 const uint32_t *values);
+static void warppointer(xcb_window_t win, int16_t x, int16_t y);
+static bool afterconfigure(struct client *client, xcb_generic_event_t *ev);
+#ifdef DEBUG
+static void verifygeom(void *data);
+static void verifygeomreply(void *reply, xcb_generic_error_t *error,
+                            void *data);
+#endif
+static void pointerfocus(struct client *client);
+static bool runreplies(void);
+static void handle_maprequest(xcb_generic_event_t *ev);
+static void handle_destroynotify(xcb_generic_event_t *ev);
+static void handle_buttonpress(xcb_generic_event_t *ev);
+static void handle_motionnotify(xcb_generic_event_t *ev);
+static void handle_buttonrelease(xcb_generic_event_t *ev);
+static void handle_keyrelease(xcb_generic_event_t *ev);
+static void handle_enternotify(xcb_generic_event_t *ev);
+static void handle_configurenotify(xcb_generic_event_t *ev);
+static void handle_clientmessage(xcb_generic_event_t *ev);
+static void handle_circulaterequest(xcb_generic_event_t *ev);
+static void handle_mappingnotify(xcb_generic_event_t *ev);
+static void handle_unmapnotify(xcb_generic_event_t *ev);
+static void handle_createnotify(xcb_generic_event_t *ev);
+static void handle_reparentnotify(xcb_generic_event_t *ev);
+static void handle_propertynotify(xcb_generic_event_t *ev);
+static void handle_randrscreenchange(xcb_generic_event_t *ev);
+static int getmonitors(void);
+static void updatemonitor(struct monitor *mon, int16_t x, int16_t y,
+                          uint16_t width, uint16_t height);
+static void dropmonitor(struct monitor *mon);
+static void handle_syncalarm(xcb_generic_event_t *ev);
+static void sethandler(uint8_t type, handlerfn_t fn, const char *name);
+static void setuphandlers(void);
+static void handleevent(xcb_generic_event_t *ev);
+static unsigned drainevents(void);
+static void dropevent(unsigned i);
+static bool stepkey(const xcb_key_press_event_t *e);
+static void mergeconfreq(xcb_configure_request_event_t *e,
+                         xcb_configure_request_event_t *l);
+static bool confbarrier(xcb_generic_event_t *ev, xcb_window_t win);
+static void coalesce(void);
+static xcb_window_t evwindow(xcb_generic_event_t *ev);
+static void elidestale(void);
 static void events(void);
 static void printhelp(void);
-static void sigcatch(int sig);
-static xcb_atom_t getatom(char *atom_name);
+static void printstats(void);
+static void sigcatch(int sig, void *data);
 
 
 /* Function bodies. */
@@ -486,6 +933,11 @@ struct modkeycodes getmodkeys(xcb_mod_mask_t modmask)
  */
 void cleanup(int code)
 {
+    if (conf.stats)
+    {
+        printstats();
+    }
+
     xcb_set_input_focus(conn, XCB_NONE,
                         XCB_INPUT_FOCUS_POINTER_ROOT,
                         XCB_CURRENT_TIME);
@@ -524,50 +976,28 @@ void setwmdesktop(xcb_drawable_t win, uint32_t ws)
 }
 
 /*
- * Get EWWM hint so we might know what workspace window win should be
- * visible on.
+ * Get the workspace from a _NET_WM_DESKTOP property reply, which may
+ * be NULL.
  *
  * Returns either workspace, NET_WM_FIXED if this window should be
  * visible on all workspaces or MCWM_NOWS if we didn't find any hints.
  */
-int32_t getwmdesktop(xcb_drawable_t win)
+uint32_t desktopfromreply(xcb_get_property_reply_t *reply)
 {
-    xcb_get_property_reply_t *reply;
-    xcb_get_property_cookie_t cookie;
     uint32_t *wsp;
-    uint32_t ws;
-
-    cookie = xcb_get_property(conn, false, win, atom_desktop,
-                              XCB_GET_PROPERTY_TYPE_ANY, 0,
-                              sizeof (int32_t));
-
-    reply = xcb_get_property_reply(conn, cookie, NULL);
-    if (NULL == reply)
-    {
-        fprintf(stderr, "mcwm: Couldn't get properties for win %d\n", win);
-        return MCWM_NOWS;
-    }
 
     /* Length is 0 if we didn't find it. */
-    if (0 == xcb_get_property_value_length(reply))
+    if (NULL == reply || 0 == xcb_get_property_value_length(reply))
     {
         PDEBUG("_NET_WM_DESKTOP reply was 0 length.\n");
-        goto bad;
+        return MCWM_NOWS;
     }
 
     wsp = xcb_get_property_value(reply);
 
-    ws = *wsp;
-
-    PDEBUG("got _NET_WM_DESKTOP: %d stored at %p.\n", ws, (void *)wsp);
-
-    free(reply);
-
-    return ws;
+    PDEBUG("got _NET_WM_DESKTOP: %d stored at %p.\n", *wsp, (void *)wsp);
 
-bad:
-    free(reply);
-    return MCWM_NOWS;
+    return *wsp;
 }
 
 /* Add a window, specified by client, to workspace ws. */
@@ -614,6 +1044,7 @@ void changeworkspace(uint32_t ws)
 {
     struct item *item;
     struct client *client;
+    xcb_void_cookie_t cookie;
 
     if (ws == curws)
     {
@@ -629,7 +1060,7 @@ void changeworkspace(uint32_t ws)
      */
     if (NULL != focuswin && !focuswin->fixed)
     {
-        setunfocus(focuswin->id);
+        setunfocus(focuswin);
         focuswin = NULL;
     }
 
@@ -644,11 +1075,12 @@ void changeworkspace(uint32_t ws)
         if (!client->fixed)
         {
             /*
-             * This is an ordinary window. Just unmap it. Note that
-             * this will generate an unnecessary UnmapNotify event
-             * which we will try to handle later.
+             * This is an ordinary window. Just unmap it. This
+             * generates an UnmapNotify we don't need, so remember to
+             * ignore it.
              */
-            xcb_unmap_window(conn, client->id);
+            cookie = xcb_unmap_window(conn, client->id);
+            expectecho(cookie.sequence, XCB_UNMAP_NOTIFY, client->id);
         }
     }
 
@@ -663,12 +1095,11 @@ void changeworkspace(uint32_t ws)
         /* Fixed windows are already mapped. Map everything else. */
         if (!client->fixed)
         {
+            commitgeom(client);
             xcb_map_window(conn, client->id);
         }
     }
 
-    xcb_flush(conn);
-
     curws = ws;
 }
 
@@ -678,7 +1109,6 @@ void changeworkspace(uint32_t ws)
  */
 void fixwindow(struct client *client, bool setcolour)
 {
-    uint32_t values[1];
     uint32_t ws;
 
     if (NULL == client)
@@ -694,9 +1124,7 @@ void fixwindow(struct client *client, bool setcolour)
         if (setcolour)
         {
             /* Set border color to ordinary focus colour. */
-            values[0] = conf.focuscol;
-            xcb_change_window_attributes(conn, client->id, XCB_CW_BORDER_PIXEL,
-                                         values);
+            setborderpixel(client, conf.focuscol);
         }
 
         /* Delete from all workspace lists except current. */
@@ -732,40 +1160,247 @@ void fixwindow(struct client *client, bool setcolour)
         if (setcolour)
         {
             /* Set border color to fixed colour. */
-            values[0] = conf.fixedcol;
-            xcb_change_window_attributes(conn, client->id, XCB_CW_BORDER_PIXEL,
-                                         values);
+            setborderpixel(client, conf.fixedcol);
         }
     }
+}
 
-    xcb_flush(conn);
+/*
+ * Find the visual with id on our screen.
+ *
+ * Returns the visual or NULL if not found.
+ */
+xcb_visualtype_t *findvisual(xcb_visualid_t id)
+{
+    xcb_depth_iterator_t depths;
+    xcb_visualtype_iterator_t visuals;
+
+    for (depths = xcb_screen_allowed_depths_iterator(screen); depths.rem;
+         xcb_depth_next(&depths))
+    {
+        for (visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem;
+             xcb_visualtype_next(&visuals))
+        {
+            if (id == visuals.data->visual_id)
+            {
+                return visuals.data;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Parse colstr, either #rgb, #rrggbb or a name from rgb.txt, into 16
+ * bit colour values.
+ *
+ * Returns true if we know the colour, false if the server has to
+ * look it up.
+ */
+bool parsecolor(const char *colstr, uint16_t *red, uint16_t *green,
+                uint16_t *blue)
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    unsigned long value;
+    size_t len;
+    char *end;
+
+    if ('#' != colstr[0])
+    {
+        if (!lookuprgb(colstr, &r, &g, &b))
+        {
+            return false;
+        }
+
+        *red = r * 0x101;
+        *green = g * 0x101;
+        *blue = b * 0x101;
+
+        return true;
+    }
+
+    len = strlen(colstr + 1);
+    value = strtoul(colstr + 1, &end, 16);
+    if ('\0' != *end || (3 != len && 6 != len))
+    {
+        return false;
+    }
+
+    if (3 == len)
+    {
+        /* #rgb means #r0g0b0, just like in Xlib. */
+        *red = ((value >> 8) & 0xf) << 12;
+        *green = ((value >> 4) & 0xf) << 12;
+        *blue = (value & 0xf) << 12;
+    }
+    else
+    {
+        *red = ((value >> 16) & 0xff) << 8;
+        *green = ((value >> 8) & 0xff) << 8;
+        *blue = (value & 0xff) << 8;
+    }
+
+    return true;
+}
+
+/*
+ * Scale the 16 bit colour value to the bits in the pixel mask of a
+ * TrueColor visual.
+ *
+ * Returns the bits in their place in the pixel.
+ */
+uint32_t scalecolor(uint16_t value, uint32_t mask)
+{
+    int shift = 0;
+    int bits = 0;
+
+    if (0 == mask)
+    {
+        return 0;
+    }
+
+    while (!(mask & (1u << shift)))
+    {
+        shift ++;
+    }
+
+    while (shift + bits < 32 && mask & (1u << (shift + bits)))
+    {
+        bits ++;
+    }
+
+    if (bits > 16)
+    {
+        bits = 16;
+    }
+
+    return ((uint32_t) (value >> (16 - bits)) << shift) & mask;
 }
 
 /*
- * Get the pixel values of a named colour colstr.
+ * Get the pixel values of all colours in colors, which ends with an
+ * entry with a NULL name.
  *
- * Returns pixel values.
- * */
-uint32_t getcolor(const char *colstr)
+ * On TrueColor visuals we compute pixels ourselves for the colours we
+ * know. The rest are allocated from the server, all requests sent
+ * before we wait for the first reply.
+ *
+ * Exits if we can't get a colour.
+ */
+void getcolors(const struct colordef *colors)
 {
-    xcb_alloc_named_color_reply_t *col_reply;
+    struct
+    {
+        bool local;
+        bool named;
+        xcb_alloc_color_cookie_t rgb;
+        xcb_alloc_named_color_cookie_t name;
+    } *cookies;
     xcb_colormap_t colormap;
-    xcb_generic_error_t *error;
-    xcb_alloc_named_color_cookie_t colcookie;
+    xcb_alloc_color_reply_t *rgbreply;
+    xcb_alloc_named_color_reply_t *namereply;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+    bool known;
+    bool failed = false;
+    int len;
+    int i;
 
-    colormap = screen->default_colormap;
-    colcookie = xcb_alloc_named_color(conn, colormap, strlen(colstr), colstr);
-    col_reply = xcb_alloc_named_color_reply(conn, colcookie, &error);
-    if (NULL != error)
+    for (len = 0; NULL != colors[len].name; len ++)
     {
-        fprintf(stderr, "mcwm: Couldn't get pixel value for colour %s. "
-                "Exiting.\n", colstr);
+        ;
+    }
 
+    if (NULL == (cookies = calloc(len, sizeof (*cookies))))
+    {
+        fprintf(stderr, "mcwm: Out of memory.\n");
         xcb_disconnect(conn);
         exit(1);
     }
 
-    return col_reply->pixel;
+    colormap = screen->default_colormap;
+
+    for (i = 0; i < len; i ++)
+    {
+        known = parsecolor(colors[i].name, &red, &green, &blue);
+
+        if (known && NULL != visual
+            && XCB_VISUAL_CLASS_TRUE_COLOR == visual->_class)
+        {
+            *colors[i].pixel = scalecolor(red, visual->red_mask)
+                | scalecolor(green, visual->green_mask)
+                | scalecolor(blue, visual->blue_mask);
+
+            PDEBUG("Colour %s is pixel 0x%x, computed.\n", colors[i].name,
+                   *colors[i].pixel);
+
+            cookies[i].local = true;
+            continue;
+        }
+
+        if (known)
+        {
+            cookies[i].rgb = xcb_alloc_color(conn, colormap, red, green,
+                                             blue);
+        }
+        else
+        {
+            cookies[i].named = true;
+            cookies[i].name = xcb_alloc_named_color(
+                conn, colormap, strlen(colors[i].name), colors[i].name);
+        }
+    }
+
+    for (i = 0; i < len; i ++)
+    {
+        if (cookies[i].local)
+        {
+            continue;
+        }
+
+        if (cookies[i].named)
+        {
+            namereply = xcb_alloc_named_color_reply(conn, cookies[i].name,
+                                                    NULL);
+            if (NULL == namereply)
+            {
+                fprintf(stderr, "mcwm: Couldn't get pixel value for "
+                        "colour %s.\n", colors[i].name);
+                failed = true;
+                continue;
+            }
+
+            *colors[i].pixel = namereply->pixel;
+            free(namereply);
+        }
+        else
+        {
+            rgbreply = xcb_alloc_color_reply(conn, cookies[i].rgb, NULL);
+            if (NULL == rgbreply)
+            {
+                fprintf(stderr, "mcwm: Couldn't allocate colour %s.\n",
+                        colors[i].name);
+                failed = true;
+                continue;
+            }
+
+            *colors[i].pixel = rgbreply->pixel;
+            free(rgbreply);
+        }
+    }
+
+    free(cookies);
+
+    if (failed)
+    {
+        fprintf(stderr, "mcwm: Exiting.\n");
+        xcb_disconnect(conn);
+        exit(1);
+    }
 }
 
 /* Forget everything about client client. */
@@ -793,6 +1428,9 @@ void forgetclient(struct client *client)
     }
 
     /* Remove from global window list. */
+    freeprops(&client->props);
+    freesync(client);
+    freeflood(client);
     freeitem(&winlist, NULL, client->winitem);
 }
 
@@ -840,6 +1478,9 @@ void forgetwin(xcb_window_t win)
                 }
             }
 
+            freeprops(&client->props);
+            freesync(client);
+            freeflood(client);
             free(item->data);
             delitem(&winlist, item);
 
@@ -975,12 +1616,15 @@ void fitonscreen(struct client *client)
 }
 
 /*
- * Set position, geometry and attributes of a new window and show it
- * on the screen.
+ * A new window asked to be mapped. Ask for everything we need to know
+ * about it. The window is set up and shown on the screen by
+ * adoptdone() when all the replies are in.
  */
 void newwin(xcb_window_t win)
 {
-    struct client *client;
+    struct adopt *adopt;
+    xcb_get_geometry_cookie_t geomcookie;
+    xcb_query_pointer_cookie_t pointercookie;
 
     if (NULL != findclient(win))
     {
@@ -993,3277 +1637,6729 @@ void newwin(xcb_window_t win)
         return;
     }
 
-    /*
-     * Set up stuff, like borders, add the window to the client list,
-     * et cetera.
-     */
-    client = setupwin(win);
-    if (NULL == client)
+    adopt = findadopt(win);
+    if (NULL == adopt)
     {
-        fprintf(stderr, "mcwm: Couldn't set up window. Out of memory.\n");
+        /*
+         * We didn't see this one being created. Perhaps it was
+         * reparented to the root. Ask for everything now.
+         */
+        if (NULL == (adopt = newadopt(win)))
+        {
+            return;
+        }
+
+        geomcookie = xcb_get_geometry(conn, win);
+        expectreply(geomcookie.sequence, adoptgeomreply,
+                    (void *) (uintptr_t) win);
+        adopt->waiting ++;
+    }
+    else if (adopt->mapped)
+    {
+        /* We're already waiting to set this one up. */
         return;
     }
+    else if (0 == adopt->waiting)
+    {
+        stats.prefetched ++;
+    }
 
-    /* Add this window to the current workspace. */
-    addtoworkspace(client, curws);
+    adopt->mapped = true;
 
-    /*
-     * If the client doesn't say the user specified the coordinates
-     * for the window we map it where our pointer is instead.
-     */
-    if (!client->usercoord)
+    if (NULL != adopt->timer)
     {
-        int16_t pointx;
-        int16_t pointy;
-        PDEBUG("Coordinates not set by user. Using pointer: %d,%d.\n",
-               pointx, pointy);
+        deltimer(adopt->timer);
+        adopt->timer = NULL;
+    }
 
-        /* Get pointer position so we can move the window to the cursor. */
-        if (!getpointer(screen->root, &pointx, &pointy))
-        {
-            PDEBUG("Failed to get pointer coords!\n");
-            pointx = 0;
-            pointy = 0;
-        }
+    /*
+     * We need the pointer position so we can move the window to the
+     * cursor. A map request doesn't tell us where the pointer is, and
+     * it moves over client windows without telling us, so ask.
+     */
+    pointercookie = xcb_query_pointer(conn, screen->root);
+    expectreply(pointercookie.sequence, adoptpointerreply,
+                (void *) (uintptr_t) win);
+    adopt->waiting ++;
+    stats.pointerqueries ++;
+}
 
-        client->x = pointx;
-        client->y = pointy;
+/*
+ * Start keeping track of window win, which we will probably manage
+ * soon. Asks for all the properties setupwin() needs.
+ *
+ * Returns adoption data or NULL if out of memory.
+ */
+struct adopt *newadopt(xcb_window_t win)
+{
+    struct item *item;
+    struct adopt *adopt;
+    uint32_t values[1];
 
-        movewindow(client->id, client->x, client->y);
-    }
-    else
+    if (NULL == (item = additem(&adoptlist)))
     {
-        PDEBUG("User set coordinates.\n");
+        fprintf(stderr, "mcwm: Couldn't set up window. Out of memory.\n");
+        return NULL;
     }
 
-    /* Find the physical output this window will be on if RANDR is active. */
-    if (-1 != randrbase)
+    if (NULL == (adopt = calloc(1, sizeof (struct adopt))))
     {
-        client->monitor = findmonbycoord(client->x, client->y);
-        if (NULL == client->monitor)
-        {
-            /*
-             * Window coordinates are outside all physical monitors.
-             * Choose the first screen.
-             */
-            if (NULL != monlist)
-            {
-                client->monitor = monlist->data;
-            }
-        }
+        fprintf(stderr, "mcwm: Couldn't set up window. Out of memory.\n");
+        delitem(&adoptlist, item);
+        return NULL;
     }
 
-    fitonscreen(client);
-
-    /* Show window on screen. */
-    xcb_map_window(conn, client->id);
-
-    /* Declare window normal. */
-    long data[] = { XCB_ICCCM_WM_STATE_NORMAL, XCB_NONE };
-    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, client->id,
-                              wm_state, wm_state, 32, 2, data);
+    item->data = adopt;
+    adopt->id = win;
+    adopt->item = item;
+    initprops(&adopt->props);
 
     /*
-     * Move cursor into the middle of the window so we don't lose the
-     * pointer to another window.
+     * Ask to hear about property changes before we fetch anything, so
+     * we can't miss a change made in between.
      */
-    xcb_warp_pointer(conn, XCB_NONE, win, 0, 0, 0, 0,
-                     client->width / 2, client->height / 2);
+    values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_change_window_attributes(conn, win, XCB_CW_EVENT_MASK, values);
 
-    xcb_flush(conn);
+    fetchprops(win);
+
+    adopt->timer = addtimer(ADOPT_TIMEOUT, adopttimeout,
+                            (void *) (uintptr_t) win);
+
+    return adopt;
 }
 
-/* Set border colour, width and event mask for window. */
-struct client *setupwin(xcb_window_t win)
+/*
+ * A new window hasn't asked to be mapped for a long time. Stop
+ * listening to it and forget what we fetched. If it's mapped later
+ * we start over.
+ */
+void adopttimeout(void *data)
 {
-    uint32_t mask = 0;
-    uint32_t values[2];
-    struct item *item;
-    struct client *client;
-    xcb_size_hints_t hints;
-    uint32_t ws;
+    struct adopt *adopt;
+    uint32_t values[1];
+
+    if (NULL == (adopt = findadopt((uintptr_t) data)))
+    {
+        return;
+    }
 
-    /* Set default border color. */
-    values[0] = conf.unfocuscol;
-    xcb_change_window_attributes(conn, win, XCB_CW_BORDER_PIXEL, values);
+    adopt->timer = NULL;
 
-    /* Subscribe to events we want to know about in this window. */
-    mask = XCB_CW_EVENT_MASK;
-    values[0] = XCB_EVENT_MASK_ENTER_WINDOW;
-    xcb_change_window_attributes_checked(conn, win, mask, values);
+    if (adopt->mapped)
+    {
+        return;
+    }
 
     /*
-     * Add this window to the X Save Set, that is, the windows that
-     * will be automatically restored if we die.
+     * Replies still on their way would be counted against a new
+     * adoption of the same window. Wait for them.
      */
-    xcb_change_save_set(conn, XCB_SET_MODE_INSERT, win);
+    if (0 != adopt->waiting)
+    {
+        adopt->timer = addtimer(ADOPT_TIMEOUT, adopttimeout, data);
+        return;
+    }
 
-    xcb_flush(conn);
+    PDEBUG("Window %d was never mapped. Forgetting it.\n", adopt->id);
 
-    /* Remember window and store a few things about it. */
+    values[0] = XCB_EVENT_MASK_NO_EVENT;
+    xcb_change_window_attributes(conn, adopt->id, XCB_CW_EVENT_MASK, values);
 
-    item = additem(&winlist);
+    stats.adoptexpired ++;
+    forgetadopt(adopt->id);
+}
 
-    if (NULL == item)
+/*
+ * Find window win among the windows we're about to manage.
+ *
+ * Returns adoption data or NULL if not found.
+ */
+struct adopt *findadopt(xcb_window_t win)
+{
+    struct item *item;
+    struct adopt *adopt;
+
+    for (item = adoptlist; item != NULL; item = item->next)
     {
-        PDEBUG("newwin: Out of memory.\n");
-        return NULL;
+        adopt = item->data;
+        if (win == adopt->id)
+        {
+            return adopt;
+        }
     }
 
-    client = malloc(sizeof (struct client));
-    if (NULL == client)
+    return NULL;
+}
+
+/* Stop trying to set up window win, if we were. */
+void forgetadopt(xcb_window_t win)
+{
+    struct adopt *adopt;
+
+    if (NULL != (adopt = findadopt(win)))
     {
-        PDEBUG("newwin: Out of memory.\n");
-        return NULL;
+        if (NULL != adopt->timer)
+        {
+            deltimer(adopt->timer);
+        }
+        freeprops(&adopt->props);
+        freeitem(&adoptlist, NULL, adopt->item);
     }
+}
 
-    item->data = client;
-
-    /* Initialize client. */
-    client->id = win;
-    client->usercoord = false;
-    client->x = 0;
-    client->y = 0;
-    client->width = 0;
-    client->height = 0;
-    client->min_width = 0;
-    client->min_height = 0;
-    client->max_width = screen->width_in_pixels;
-    client->max_height = screen->height_in_pixels;
-    client->base_width = 0;
-    client->base_height = 0;
-    client->width_inc = 1;
-    client->height_inc = 1;
-    client->vertmaxed = false;
-    client->maxed = false;
-    client->fixed = false;
-    client->monitor = NULL;
+/*
+ * Find the property cache of window win.
+ *
+ * Returns the cache or NULL if we aren't keeping one for win.
+ */
+struct props *findprops(xcb_window_t win)
+{
+    struct client *client;
+    struct adopt *adopt;
 
-    client->winitem = item;
+    if (NULL != (client = findclient(win)))
+    {
+        return &client->props;
+    }
 
-    for (ws = 0; ws < WORKSPACES; ws ++)
+    if (NULL != (adopt = findadopt(win)))
     {
-        client->wsitem[ws] = NULL;
+        return &adopt->props;
     }
 
-    PDEBUG("Adding window %d\n", client->id);
+    return NULL;
+}
 
-    setborders(client, conf.borderwidth);
+/* Set up an empty property cache. */
+void initprops(struct props *props)
+{
+    props->gothints = false;
+    props->gotwmhints = false;
+    props->desktop = MCWM_NOWS;
+    props->deletewindow = false;
+    props->syncrequest = false;
+    props->synccounter = XCB_NONE;
+    props->transient = XCB_NONE;
+    props->instance = NULL;
+    props->wmclass = NULL;
+    props->name = NULL;
+    props->iconname = NULL;
+}
+
+/* Free the strings in a property cache. */
+void freeprops(struct props *props)
+{
+    free(props->instance);
+    free(props->wmclass);
+    free(props->name);
+    free(props->iconname);
+    props->instance = NULL;
+    props->wmclass = NULL;
+    props->name = NULL;
+    props->iconname = NULL;
+}
+
+/*
+ * Ask for all the properties we cache for window win. We must already
+ * have selected PropertyChange on it so we hear about later changes.
+ *
+ * We send all requests at once. The callbacks only get the window ID,
+ * since the window might be gone before the replies are.
+ */
+void fetchprops(xcb_window_t win)
+{
+    fetchprop(win, XCB_ATOM_WM_NORMAL_HINTS);
+    fetchprop(win, XCB_ATOM_WM_HINTS);
+    fetchprop(win, atom_desktop);
+    fetchprop(win, wm_protocols);
+    fetchprop(win, net_wm_sync_request_counter);
+    fetchprop(win, XCB_ATOM_WM_TRANSIENT_FOR);
+    fetchprop(win, XCB_ATOM_WM_CLASS);
+    fetchprop(win, XCB_ATOM_WM_NAME);
+    fetchprop(win, XCB_ATOM_WM_ICON_NAME);
+}
+
+/*
+ * Ask for property atom of window win, if it's one we keep in the
+ * property cache.
+ *
+ * Returns true if we sent a request.
+ */
+bool fetchprop(xcb_window_t win, xcb_atom_t atom)
+{
+    xcb_get_property_cookie_t cookie;
+    replyfn_t fn;
+    struct adopt *adopt;
 
-    /* Get window geometry. */
-    if (!getgeom(client->id, &client->x, &client->y, &client->width,
-                 &client->height))
+    if (XCB_ATOM_WM_NORMAL_HINTS == atom)
     {
-        fprintf(stderr, "Couldn't get geometry in initial setup of window.\n");
+        cookie = xcb_icccm_get_wm_normal_hints(conn, win);
+        fn = hintsreply;
     }
-
-    /*
-     * Get the window's incremental size step, if any.
-     */
-    if (!xcb_icccm_get_wm_normal_hints_reply(
-            conn, xcb_icccm_get_wm_normal_hints_unchecked(
-                conn, win), &hints, NULL))
+    else if (atom_desktop == atom)
     {
-        PDEBUG("Couldn't get size hints.\n");
+        cookie = xcb_get_property(conn, false, win, atom_desktop,
+                                  XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                  sizeof (int32_t));
+        fn = desktopreply;
     }
-
-    /*
-     * The user specified the position coordinates. Remember that so
-     * we can use geometry later.
-     */
-    if (hints.flags & XCB_ICCCM_SIZE_HINT_US_POSITION)
+    else if (wm_protocols == atom)
     {
-        client->usercoord = true;
+        cookie = xcb_icccm_get_wm_protocols(conn, win, wm_protocols);
+        fn = protocolsreply;
     }
-
-    if (hints.flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE)
+    else if (net_wm_sync_request_counter == atom)
     {
-        client->min_width = hints.min_width;
-        client->min_height = hints.min_height;
+        cookie = xcb_get_property(conn, false, win,
+                                  net_wm_sync_request_counter,
+                                  XCB_ATOM_CARDINAL, 0, 1);
+        fn = synccounterreply;
     }
-
-    if (hints.flags & XCB_ICCCM_SIZE_HINT_P_MAX_SIZE)
+    else if (XCB_ATOM_WM_TRANSIENT_FOR == atom)
     {
-
-        client->max_width = hints.max_width;
-        client->max_height = hints.max_height;
+        cookie = xcb_icccm_get_wm_transient_for(conn, win);
+        fn = transientreply;
     }
-
-    if (hints.flags & XCB_ICCCM_SIZE_HINT_P_RESIZE_INC)
+    else if (XCB_ATOM_WM_HINTS == atom)
     {
-        client->width_inc = hints.width_inc;
-        client->height_inc = hints.height_inc;
-
-        PDEBUG("widht_inc %d\nheight_inc %d\n", client->width_inc,
-               client->height_inc);
+        cookie = xcb_icccm_get_wm_hints(conn, win);
+        fn = wmhintsreply;
+    }
+    else if (XCB_ATOM_WM_CLASS == atom)
+    {
+        cookie = xcb_icccm_get_wm_class(conn, win);
+        fn = classreply;
+    }
+    else if (XCB_ATOM_WM_NAME == atom)
+    {
+        cookie = xcb_icccm_get_wm_name(conn, win);
+        fn = namereply;
+    }
+    else if (XCB_ATOM_WM_ICON_NAME == atom)
+    {
+        cookie = xcb_icccm_get_wm_icon_name(conn, win);
+        fn = iconnamereply;
+    }
+    else
+    {
+        return false;
     }
 
-    if (hints.flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE)
+    expectreply(cookie.sequence, fn, (void *) (uintptr_t) win);
+
+    if (NULL != (adopt = findadopt(win)))
     {
-        client->base_width = hints.base_width;
-        client->base_height = hints.base_height;
+        adopt->waiting ++;
     }
 
-    return client;
+    return true;
 }
 
-/*
- * Get a keycode from a keysym.
- *
- * Returns keycode value.
- */
-xcb_keycode_t keysymtokeycode(xcb_keysym_t keysym, xcb_key_symbols_t *keysyms)
+/* A reply we asked for in fetchprop() has been handled. */
+void propdone(xcb_window_t win)
 {
-    xcb_keycode_t *keyp;
-    xcb_keycode_t key;
+    struct adopt *adopt;
 
-    /* We only use the first keysymbol, even if there are more. */
-    keyp = xcb_key_symbols_get_keycode(keysyms, keysym);
-    if (NULL == keyp)
+    if (NULL != (adopt = findadopt(win)))
     {
-        fprintf(stderr, "mcwm: Couldn't look up key. Exiting.\n");
-        exit(1);
-        return 0;
+        adopt->waiting --;
+        adoptdone(adopt);
     }
-
-    key = *keyp;
-    free(keyp);
-
-    return key;
 }
 
 /*
- * Set up all shortcut keys.
- *
- * Returns 0 on success, non-zero otherwise.
+ * WM_NORMAL_HINTS arrived. If we already manage the window, its size
+ * limits and increments change right away.
  */
-int setupkeys(void)
+void hintsreply(void *reply, xcb_generic_error_t *error, void *data)
 {
-    xcb_key_symbols_t *keysyms;
-    unsigned i;
-
-    /* Get all the keysymbols. */
-    keysyms = xcb_key_symbols_alloc(conn);
+    struct props *props;
+    struct client *client;
 
-    /*
-     * Find out what keys generates our MODKEY mask. Unfortunately it
-     * might be several keys.
-     */
-    if (NULL != modkeys.keycodes)
+    if (NULL == (props = findprops((uintptr_t) data)))
     {
-        free(modkeys.keycodes);
+        return;
     }
-    modkeys = getmodkeys(MODKEY);
 
-    if (0 == modkeys.len)
+    props->gothints = NULL != reply
+        && xcb_icccm_get_wm_size_hints_from_reply(&props->hints, reply);
+    if (!props->gothints)
     {
-        fprintf(stderr, "We couldn't find any keycodes to our main modifier "
-                "key!\n");
-        return -1;
+        PDEBUG("Couldn't get size hints.\n");
     }
 
-    for (i = 0; i < modkeys.len; i ++)
+    if (NULL != (client = findclient((uintptr_t) data)))
     {
-        /*
-         * Grab the keys that are bound to MODKEY mask with any other
-         * modifier.
-         */
-        xcb_grab_key(conn, 1, screen->root, XCB_MOD_MASK_ANY,
-                     modkeys.keycodes[i],
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+        applyhints(client);
     }
 
-    /* Now grab the rest of the keys with the MODKEY modifier. */
-    for (i = KEY_F; i < KEY_MAX; i ++)
-    {
-        if (XK_VoidSymbol == keys[i].keysym)
-        {
-            keys[i].keycode = 0;
-            continue;
-        }
+    propdone((uintptr_t) data);
+}
 
-        keys[i].keycode = keysymtokeycode(keys[i].keysym, keysyms);
-        if (0 == keys[i].keycode)
-        {
-            /* Couldn't set up keys! */
+/* _NET_WM_DESKTOP arrived. */
+void desktopreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    struct props *props;
 
-            /* Get rid of key symbols. */
-            xcb_key_symbols_free(keysyms);
+    if (NULL == (props = findprops((uintptr_t) data)))
+    {
+        return;
+    }
 
-            return -1;
-        }
+    props->desktop = desktopfromreply(reply);
 
-        /* Grab other keys with a modifier mask. */
-        xcb_grab_key(conn, 1, screen->root, MODKEY, keys[i].keycode,
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+    propdone((uintptr_t) data);
+}
 
-        /*
-         * XXX Also grab it's shifted counterpart. A bit ugly here
-         * because we grab all of them not just the ones we want.
-         */
-        xcb_grab_key(conn, 1, screen->root, MODKEY | SHIFTMOD,
-                     keys[i].keycode,
-                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+/* WM_PROTOCOLS arrived. */
+void protocolsreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_get_property_reply_t *prop = reply;
+    struct props *props;
+    xcb_atom_t *atoms;
+    int len;
+    int i;
+
+    if (NULL == (props = findprops((uintptr_t) data)))
+    {
+        return;
     }
 
-    /* Need this to take effect NOW! */
-    xcb_flush(conn);
+    props->deletewindow = false;
+    props->syncrequest = false;
 
-    /* Get rid of the key symbols table. */
-    xcb_key_symbols_free(keysyms);
+    if (NULL != prop && XCB_ATOM_ATOM == prop->type && 32 == prop->format)
+    {
+        atoms = xcb_get_property_value(prop);
+        len = xcb_get_property_value_length(prop) / sizeof (xcb_atom_t);
 
-    return 0;
+        for (i = 0; i < len; i ++)
+        {
+            if (atoms[i] == wm_delete_window)
+            {
+                props->deletewindow = true;
+            }
+            else if (atoms[i] == net_wm_sync_request)
+            {
+                props->syncrequest = true;
+            }
+        }
+    }
+
+    propdone((uintptr_t) data);
 }
 
 /*
- * Walk through all existing windows and set them up.
- *
- * Returns 0 on success.
+ * _NET_WM_SYNC_REQUEST_COUNTER arrived. If the client switched to
+ * another counter, we start over with the new one.
  */
-int setupscreen(void)
+void synccounterreply(void *reply, xcb_generic_error_t *error, void *data)
 {
-    xcb_query_tree_reply_t *reply;
-    xcb_query_pointer_reply_t *pointer;
-    int i;
-    int len;
-    xcb_window_t *children;
-    xcb_get_window_attributes_reply_t *attr;
+    xcb_get_property_reply_t *prop = reply;
+    struct props *props;
     struct client *client;
-    uint32_t ws;
 
-    /* Get all children. */
-    reply = xcb_query_tree_reply(conn,
-                                 xcb_query_tree(conn, screen->root), 0);
-    if (NULL == reply)
+    if (NULL == (props = findprops((uintptr_t) data)))
     {
-        return -1;
+        return;
     }
 
-    len = xcb_query_tree_children_length(reply);
-    children = xcb_query_tree_children(reply);
+    props->synccounter = XCB_NONE;
 
-    /* Set up all windows on this root. */
-    for (i = 0; i < len; i ++)
+    if (NULL != prop && XCB_ATOM_CARDINAL == prop->type
+        && 32 == prop->format
+        && sizeof (xcb_sync_counter_t) <= xcb_get_property_value_length(prop))
     {
-        attr = xcb_get_window_attributes_reply(
-            conn, xcb_get_window_attributes(conn, children[i]), NULL);
-
-        if (!attr)
-        {
-            fprintf(stderr, "Couldn't get attributes for window %d.",
-                    children[i]);
-            continue;
-        }
+        props->synccounter = *(xcb_sync_counter_t *)
+            xcb_get_property_value(prop);
+    }
 
-        /*
-         * Don't set up or even bother windows in override redirect
-         * mode.
-         *
-         * This mode means they wouldn't have been reported to us
-         * with a MapRequest if we had been running, so in the
-         * normal case we wouldn't have seen them.
-         *
-         * Only handle visible windows.
-         */
-        if (!attr->override_redirect
-            && attr->map_state == XCB_MAP_STATE_VIEWABLE)
-        {
-            client = setupwin(children[i]);
-            if (NULL != client)
-            {
-                /*
-                 * Find the physical output this window will be on if
-                 * RANDR is active.
-                 */
-                if (-1 != randrbase)
-                {
-                    PDEBUG("Looking for monitor on %d x %d.\n", client->x,
-                        client->y);
-                    client->monitor = findmonbycoord(client->x, client->y);
-#if DEBUG
-                    if (NULL != client->monitor)
-                    {
-                        PDEBUG("Found client on monitor %s.\n",
-                               client->monitor->name);
-                    }
-                    else
-                    {
-                        PDEBUG("Couldn't find client on any monitor.\n");
-                    }
-#endif
-                }
+    client = findclient((uintptr_t) data);
+    if (NULL != client && client->sync.counter != props->synccounter)
+    {
+        resetsync(client);
+    }
 
-                /* Fit window on physical screen. */
-                fitonscreen(client);
+    propdone((uintptr_t) data);
+}
 
-                /*
-                 * Check if this window has a workspace set already as
-                 * a WM hint.
-                 *
-                 */
-                ws = getwmdesktop(children[i]);
+/* WM_TRANSIENT_FOR arrived. */
+void transientreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    struct props *props;
 
-                if (ws == NET_WM_FIXED)
-                {
-                    /* Add to current workspace. */
-                    addtoworkspace(client, curws);
-                    /* Add to all other workspaces. */
-                    fixwindow(client, false);
-                }
-                else if (MCWM_NOWS != ws && ws < WORKSPACES)
-                {
-                    addtoworkspace(client, ws);
-                    /* If it's not our current workspace, hide it. */
-                    if (ws != curws)
-                    {
-                        xcb_unmap_window(conn, client->id);
-                    }
-                }
-                else
-                {
-                    /*
-                     * No workspace hint at all. Just add it to our
-                     * current workspace.
-                     */
-                    addtoworkspace(client, curws);
-                }
-            }
-        }
+    if (NULL == (props = findprops((uintptr_t) data)))
+    {
+        return;
+    }
 
-        free(attr);
+    if (NULL == reply
+        || !xcb_icccm_get_wm_transient_for_from_reply(&props->transient,
+                                                      reply))
+    {
+        props->transient = XCB_NONE;
     }
 
-    changeworkspace(0);
+    propdone((uintptr_t) data);
+}
 
-    /*
-     * Get pointer position so we can set focus on any window which
-     * might be under it.
-     */
-    pointer = xcb_query_pointer_reply(
-        conn, xcb_query_pointer(conn, screen->root), 0);
+/* WM_HINTS arrived. */
+void wmhintsreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    struct props *props;
 
-    if (NULL == pointer)
+    if (NULL == (props = findprops((uintptr_t) data)))
     {
-        focuswin = NULL;
+        return;
     }
-    else
+
+    props->gotwmhints = NULL != reply
+        && xcb_icccm_get_wm_hints_from_reply(&props->wmhints, reply);
+
+    propdone((uintptr_t) data);
+}
+
+/* WM_CLASS arrived. */
+void classreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_icccm_get_wm_class_reply_t wmclass;
+    struct props *props;
+
+    if (NULL == (props = findprops((uintptr_t) data)))
     {
-        setfocus(findclient(pointer->child));
-        free(pointer);
+        return;
     }
 
-    xcb_flush(conn);
+    free(props->instance);
+    free(props->wmclass);
+    props->instance = NULL;
+    props->wmclass = NULL;
 
-    free(reply);
+    /* The strings point into the reply, which our caller frees. */
+    if (NULL != reply && xcb_icccm_get_wm_class_from_reply(&wmclass, reply))
+    {
+        props->instance = strdup(wmclass.instance_name);
+        props->wmclass = strdup(wmclass.class_name);
 
-    return 0;
+        PDEBUG("Window %d has class %s, instance %s.\n",
+               (uint32_t) (uintptr_t) data, props->wmclass,
+               props->instance);
+    }
+
+    propdone((uintptr_t) data);
 }
 
-/*
- * Set up RANDR extension. Get the extension base and subscribe to
- * events.
- */
-int setuprandr(void)
+/* WM_NAME arrived. */
+void namereply(void *reply, xcb_generic_error_t *error, void *data)
 {
-    const xcb_query_extension_reply_t *extension;
-    int base;
+    struct props *props;
 
-    extension = xcb_get_extension_data(conn, &xcb_randr_id);
-    if (!extension->present)
-    {
-        PDEBUG("No RANDR extension.\n");
-        return -1;
-    }
-    else
+    if (NULL == (props = findprops((uintptr_t) data)))
     {
-        getrandr();
+        return;
     }
 
-    base = extension->first_event;
-    PDEBUG("randrbase is %d.\n", base);
+    free(props->name);
+    props->name = propstring(reply);
 
-    xcb_randr_select_input(conn, screen->root,
-                           XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
-                           XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE |
-                           XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
-                           XCB_RANDR_NOTIFY_MASK_OUTPUT_PROPERTY);
+    propdone((uintptr_t) data);
+}
 
-    xcb_flush(conn);
+/* WM_ICON_NAME arrived. */
+void iconnamereply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    struct props *props;
 
-    return base;
+    if (NULL == (props = findprops((uintptr_t) data)))
+    {
+        return;
+    }
+
+    free(props->iconname);
+    props->iconname = propstring(reply);
+
+    propdone((uintptr_t) data);
 }
 
 /*
- * Get RANDR resources and figure out how many outputs there are.
+ * Get a text property from a reply, which may be NULL.
+ *
+ * Returns a string we have to free or NULL if the property wasn't
+ * set.
  */
-void getrandr(void)
+char *propstring(xcb_get_property_reply_t *reply)
 {
-    xcb_randr_get_screen_resources_current_cookie_t rcookie;
-    xcb_randr_get_screen_resources_current_reply_t *res;
-    xcb_randr_output_t *outputs;
+    char *str;
     int len;
-    xcb_timestamp_t timestamp;
 
-    rcookie = xcb_randr_get_screen_resources_current(conn, screen->root);
-    res = xcb_randr_get_screen_resources_current_reply(conn, rcookie, NULL);
-    if (NULL == res)
+    if (NULL == reply || 8 != reply->format
+        || 0 == (len = xcb_get_property_value_length(reply)))
+    {
+        return NULL;
+    }
+
+    if (NULL == (str = malloc(len + 1)))
+    {
+        return NULL;
+    }
+
+    memcpy(str, xcb_get_property_value(reply), len);
+    str[len] = '\0';
+
+    return str;
+}
+
+/* Geometry of a window we didn't see being created arrived. */
+void adoptgeomreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_get_geometry_reply_t *geom = reply;
+    struct adopt *adopt;
+
+    if (NULL == (adopt = findadopt((uintptr_t) data)))
     {
-        printf("No RANDR extension available.\n");
         return;
     }
-    timestamp = res->config_timestamp;
 
-    len = xcb_randr_get_screen_resources_current_outputs_length(res);
-    outputs = xcb_randr_get_screen_resources_current_outputs(res);
+    if (NULL != geom)
+    {
+        adopt->geom.x = geom->x;
+        adopt->geom.y = geom->y;
+        adopt->geom.width = geom->width;
+        adopt->geom.height = geom->height;
+        adopt->gotgeom = true;
+    }
 
-    PDEBUG("Found %d outputs.\n", len);
+    adopt->waiting --;
+    adoptdone(adopt);
+}
 
-    /* Request information for all outputs. */
-    getoutputs(outputs, len, timestamp);
+/* Pointer position for placing a new window arrived. */
+void adoptpointerreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_query_pointer_reply_t *pointer = reply;
+    struct adopt *adopt;
 
-    free(res);
+    if (NULL == (adopt = findadopt((uintptr_t) data)))
+    {
+        return;
+    }
+
+    if (NULL != pointer)
+    {
+        adopt->pointx = pointer->win_x;
+        adopt->pointy = pointer->win_y;
+        adopt->gotpointer = true;
+    }
+
+    adopt->waiting --;
+    adoptdone(adopt);
 }
 
 /*
- * Walk through all the RANDR outputs (number of outputs == len) there
- * was at time timestamp.
+ * Set position, geometry and attributes of a new window and show it
+ * on the screen, if it has asked to be mapped and we have all the
+ * replies we asked for.
  */
-void getoutputs(xcb_randr_output_t *outputs, int len, xcb_timestamp_t timestamp)
+void adoptdone(struct adopt *adopt)
 {
-    char *name;
-    xcb_randr_get_crtc_info_cookie_t icookie;
-    xcb_randr_get_crtc_info_reply_t *crtc = NULL;
-    xcb_randr_get_output_info_reply_t *output;
-    struct monitor *mon;
-    struct monitor *clonemon;
-    xcb_randr_get_output_info_cookie_t ocookie[len];
-    int i;
+    struct client *client;
 
-    for (i = 0; i < len; i++)
+    if (!adopt->mapped || 0 != adopt->waiting)
     {
-        ocookie[i] = xcb_randr_get_output_info(conn, outputs[i], timestamp);
+        return;
     }
 
-    /* Loop through all outputs. */
-    for (i = 0; i < len; i ++)
+    if (!adopt->gotgeom)
     {
-        output = xcb_randr_get_output_info_reply(conn, ocookie[i], NULL);
+        /* Window is probably already gone. */
+        fprintf(stderr, "Couldn't get geometry in initial setup of "
+                "window.\n");
+        forgetadopt(adopt->id);
+        return;
+    }
 
-        if (output == NULL)
-        {
-            continue;
-        }
+    /*
+     * Set up stuff, like borders, add the window to the client list,
+     * et cetera.
+     */
+    client = setupwin(adopt->id, &adopt->geom,
+                      adopt->props.gothints ? &adopt->props.hints : NULL);
+    if (NULL == client)
+    {
+        fprintf(stderr, "mcwm: Couldn't set up window. Out of memory.\n");
+        forgetadopt(adopt->id);
+        return;
+    }
 
-        asprintf(&name, "%.*s",
-                 xcb_randr_get_output_info_name_length(output),
-                 xcb_randr_get_output_info_name(output));
+    /* The client owns the cached strings now. */
+    client->props = adopt->props;
+    initprops(&adopt->props);
 
-        PDEBUG("Name: %s\n", name);
-        PDEBUG("id: %d\n" , outputs[i]);
-        PDEBUG("Size: %d x %d mm.\n", output->mm_width, output->mm_height);
-
-        if (XCB_NONE != output->crtc)
-        {
-            icookie = xcb_randr_get_crtc_info(conn, output->crtc, timestamp);
-            crtc = xcb_randr_get_crtc_info_reply(conn, icookie, NULL);
-            if (NULL == crtc)
-            {
-                return;
-            }
-
-            PDEBUG("CRTC: at %d, %d, size: %d x %d.\n", crtc->x, crtc->y,
-                   crtc->width, crtc->height);
+    resetsync(client);
 
-            /* Check if it's a clone. */
-            clonemon = findclones(outputs[i], crtc->x, crtc->y);
-            if (NULL != clonemon)
-            {
-                PDEBUG("Monitor %s, id %d is a clone of %s, id %d. Skipping.\n",
-                       name, outputs[i],
-                       clonemon->name, clonemon->id);
-                continue;
-            }
+    /* Add this window to the current workspace. */
+    addtoworkspace(client, curws);
 
-            /* Do we know this monitor already? */
-            if (NULL == (mon = findmonitor(outputs[i])))
-            {
-                PDEBUG("Monitor not known, adding to list.\n");
-                addmonitor(outputs[i], name, crtc->x, crtc->y, crtc->width,
-                           crtc->height);
-            }
-            else
-            {
-                bool changed = false;
+    /* Add to all other workspaces if it wants to be everywhere. */
+    if (NET_WM_FIXED == client->props.desktop)
+    {
+        fixwindow(client, false);
+    }
 
-                /*
-                 * We know this monitor. Update information. If it's
-                 * smaller than before, rearrange windows.
-                 */
-                PDEBUG("Known monitor. Updating info.\n");
+    /*
+     * If the client doesn't say the user specified the coordinates
+     * for the window we map it where our pointer is instead.
+     */
+    if (!client->usercoord)
+    {
+        if (!adopt->gotpointer)
+        {
+            PDEBUG("Failed to get pointer coords!\n");
+            adopt->pointx = 0;
+            adopt->pointy = 0;
+        }
 
-                if (crtc->x != mon->x)
-                {
-                    mon->x = crtc->x;
-                    changed = true;
-                }
-                if (crtc->y != mon->y)
-                {
-                    mon->y = crtc->y;
-                    changed = true;
-                }
+        PDEBUG("Coordinates not set by user. Using pointer: %d,%d.\n",
+               adopt->pointx, adopt->pointy);
 
-                if (crtc->width != mon->width)
-                {
-                    mon->width = crtc->width;
-                    changed = true;
-                }
-                if (crtc->height != mon->height)
-                {
-                    mon->height = crtc->height;
-                    changed = true;
-                }
+        client->x = adopt->pointx;
+        client->y = adopt->pointy;
 
-                if (changed)
-                {
-                    arrbymon(mon);
-                }
-            }
+        movewindow(client->id, client->x, client->y);
+    }
+    else
+    {
+        PDEBUG("User set coordinates.\n");
+    }
 
-            free(crtc);
-        }
-        else
+    /* Find the physical output this window will be on if RANDR is active. */
+    if (-1 != randrbase)
+    {
+        client->monitor = findmonbycoord(client->x, client->y);
+        if (NULL == client->monitor)
         {
-            PDEBUG("Monitor not used at the moment.\n");
             /*
-             * Check if it was used before. If it was, do something.
+             * Window coordinates are outside all physical monitors.
+             * Choose the first screen.
              */
-            if ((mon = findmonitor(outputs[i])))
+            if (NULL != monlist)
             {
-                struct item *item;
-                struct client *client;
-
-                /* Check all windows on this monitor and move them to
-                 * the next or to the first monitor if there is no
-                 * next.
-                 *
-                 * FIXME: Use per monitor workspace list instead of
-                 * global window list.
-                 */
-                for (item = winlist; item != NULL; item = item->next)
-                {
-                    client = item->data;
-                    if (client->monitor == mon)
-                    {
-                        if (NULL == client->monitor->item->next)
-                        {
-                            if (NULL == monlist)
-                            {
-                                client->monitor = NULL;
-                            }
-                            else
-                            {
-                                client->monitor = monlist->data;
-                            }
-                        }
-                        else
-                        {
-                            client->monitor =
-                                client->monitor->item->next->data;
-                        }
-
-                        fitonscreen(client);
-                    }
-                }
-
-                /* It's not active anymore. Forget about it. */
-                delmonitor(mon);
+                client->monitor = monlist->data;
             }
         }
-
-        free(output);
     }
+
+    fitonscreen(client);
+
+    /* Show window on screen, where it should be. */
+    commitgeom(client);
+    xcb_map_window(conn, client->id);
+
+    /* Declare window normal. */
+    long data[] = { XCB_ICCCM_WM_STATE_NORMAL, XCB_NONE };
+    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, client->id,
+                              wm_state, wm_state, 32, 2, data);
+
+    /*
+     * Move cursor into the middle of the window so we don't lose the
+     * pointer to another window.
+     */
+    warppointer(client->id, client->width / 2, client->height / 2);
+
+    /*
+     * We ignore the EnterNotify from the warp, so focus the new window
+     * here.
+     */
+    pointerfocus(client);
+
+    forgetadopt(client->id);
 }
 
-void arrbymon(struct monitor *monitor)
+/*
+ * Set border colour, width and event mask for window. Use geometry
+ * geom and size hints hints, if any, we already fetched for it.
+ */
+struct client *setupwin(xcb_window_t win, const struct sizepos *geom,
+                        const xcb_size_hints_t *hints)
 {
+    uint32_t mask = 0;
+    uint32_t values[2];
     struct item *item;
     struct client *client;
+    uint32_t ws;
+    xcb_void_cookie_t savecookie;
+
+    /* Subscribe to events we want to know about in this window. */
+    mask = XCB_CW_EVENT_MASK;
+    values[0] = XCB_EVENT_MASK_ENTER_WINDOW
+        | XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_change_window_attributes_checked(conn, win, mask, values);
 
-    PDEBUG("arrbymon\n");
     /*
-     * Go through all windows on this monitor. If they don't fit on
-     * the new screen, move them around and resize them as necessary.
-     *
-     * FIXME: Use a per monitor workspace list instead of global
-     * windows list.
+     * Add this window to the X Save Set, that is, the windows that
+     * will be automatically restored if we die.
      */
-    for (item = winlist; item != NULL; item = item->next)
-    {
-        client = item->data;
-        if (client->monitor == monitor)
-        {
-            fitonscreen(client);
-        }
-    }
+    savecookie = xcb_change_save_set(conn, XCB_SET_MODE_INSERT, win);
 
-}
+    /* Remember window and store a few things about it. */
 
-struct monitor *findmonitor(xcb_randr_output_t id)
-{
-    struct item *item;
-    struct monitor *mon;
+    item = additem(&winlist);
 
-    for (item = monlist; item != NULL; item = item->next)
+    if (NULL == item)
     {
-        mon = item->data;
-        if (id == mon->id)
-        {
-            PDEBUG("findmonitor: Found it. Output ID: %d\n", mon->id);
-            return mon;
-        }
-        PDEBUG("findmonitor: Goint to %p.\n", item->next);
+        PDEBUG("newwin: Out of memory.\n");
+        return NULL;
     }
 
-    return NULL;
-}
+    client = malloc(sizeof (struct client));
+    if (NULL == client)
+    {
+        PDEBUG("newwin: Out of memory.\n");
+        return NULL;
+    }
 
-struct monitor *findclones(xcb_randr_output_t id, int16_t x, int16_t y)
-{
-    struct monitor *clonemon;
-    struct item *item;
+    item->data = client;
 
-    for (item = monlist; item != NULL; item = item->next)
-    {
-        clonemon = item->data;
+    /* Initialize client. */
+    client->id = win;
+    client->lastconfigure = savecookie.sequence;
+    client->usercoord = false;
+    client->x = 0;
+    client->y = 0;
+    client->width = 0;
+    client->height = 0;
+    client->min_width = 0;
+    client->min_height = 0;
+    client->max_width = screen->width_in_pixels;
+    client->max_height = screen->height_in_pixels;
+    client->base_width = 0;
+    client->base_height = 0;
+    client->width_inc = 1;
+    client->height_inc = 1;
+    client->vertmaxed = false;
+    client->maxed = false;
+    client->fixed = false;
+    initprops(&client->props);
+    client->sync.counter = XCB_NONE;
+    client->sync.known = false;
+    client->sync.value = 0;
+    client->sync.alarm = XCB_NONE;
+    client->sync.waiting = false;
+    client->sync.unresponsive = false;
+    client->sync.timer = NULL;
+    memset(client->sync.held, 0, sizeof (client->sync.held));
+    client->flood.start = 0;
+    client->flood.count = 0;
+    client->flood.total = 0;
+    client->flood.held = 0;
+    client->flood.pending = false;
+    client->flood.timer = NULL;
+    client->stage.dirty = 0;
+    client->stage.notify = false;
+    client->stage.sync = false;
+    client->sentborder = BORDER_UNKNOWN;
+    client->borderwidth = conf.borderwidth;
+    client->haspixel = false;
+    client->monitor = NULL;
 
-        PDEBUG("Monitor %s: x, y: %d--%d, %d--%d.\n",
-               clonemon->name,
-               clonemon->x, clonemon->x + clonemon->width,
-               clonemon->y, clonemon->y + clonemon->height);
+    client->winitem = item;
 
-        /* Check for same position. */
-        if (id != clonemon->id && clonemon->x == x && clonemon->y == y)
-        {
-            return clonemon;
-        }
+    for (ws = 0; ws < WORKSPACES; ws ++)
+    {
+        client->wsitem[ws] = NULL;
     }
 
-    return NULL;
-}
+    PDEBUG("Adding window %d\n", client->id);
 
-struct monitor *findmonbycoord(int16_t x, int16_t y)
-{
-    struct item *item;
-    struct monitor *mon;
+    /* Set default border color and width. */
+    setborderpixel(client, conf.unfocuscol);
+    setborders(client, conf.borderwidth);
 
-    for (item = monlist; item != NULL; item = item->next)
-    {
-        mon = item->data;
+    client->x = geom->x;
+    client->y = geom->y;
+    client->width = geom->width;
+    client->height = geom->height;
+    client->sent = *geom;
 
-        PDEBUG("Monitor %s: x, y: %d--%d, %d--%d.\n",
-               mon->name,
-               mon->x, mon->x + mon->width,
-               mon->y, mon->y + mon->height);
+    if (NULL == hints)
+    {
+        return client;
+    }
 
-        PDEBUG("Is %d,%d between them?\n", x, y);
+    client->props.gothints = true;
+    client->props.hints = *hints;
 
-        if (x >= mon->x && x <= mon->x + mon->width
-            && y >= mon->y && y <= mon->y + mon->height)
-        {
-            PDEBUG("findmonbycoord: Found it. Output ID: %d, name %s\n",
-                   mon->id, mon->name);
-            return mon;
-        }
+    /*
+     * The user specified the position coordinates. Remember that so
+     * we can use geometry later.
+     */
+    if (hints->flags & XCB_ICCCM_SIZE_HINT_US_POSITION)
+    {
+        client->usercoord = true;
     }
 
-    return NULL;
-}
+    applyhints(client);
 
-void delmonitor(struct monitor *mon)
-{
-    PDEBUG("Deleting output %s.\n", mon->name);
-    free(mon->name);
-    freeitem(&monlist, NULL, mon->item);
+    return client;
 }
 
-struct monitor *addmonitor(xcb_randr_output_t id, char *name,
-                           uint32_t x, uint32_t y, uint16_t width,
-                           uint16_t height)
+/*
+ * Set size limits and increments of client from the WM_NORMAL_HINTS
+ * in its property cache. Called again every time the hints change.
+ */
+void applyhints(struct client *client)
 {
-    struct item *item;
-    struct monitor *mon;
+    const xcb_size_hints_t *hints = &client->props.hints;
 
-    if (NULL == (item = additem(&monlist)))
+    client->min_width = 0;
+    client->min_height = 0;
+    client->max_width = screen->width_in_pixels;
+    client->max_height = screen->height_in_pixels;
+    client->base_width = 0;
+    client->base_height = 0;
+    client->width_inc = 1;
+    client->height_inc = 1;
+
+    if (!client->props.gothints)
     {
-        fprintf(stderr, "Out of memory.\n");
-        return NULL;
+        return;
     }
 
-    mon = malloc(sizeof (struct monitor));
-    if (NULL == mon)
+    if (hints->flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE)
     {
-        fprintf(stderr, "Out of memory.\n");
-        return NULL;
+        client->min_width = hints->min_width;
+        client->min_height = hints->min_height;
     }
 
-    item->data = mon;
+    if (hints->flags & XCB_ICCCM_SIZE_HINT_P_MAX_SIZE)
+    {
 
-    mon->id = id;
-    mon->name = name;
-    mon->x = x;
-    mon->y = y;
-    mon->width = width;
-    mon->height = height;
-    mon->item = item;
+        client->max_width = hints->max_width;
+        client->max_height = hints->max_height;
+    }
 
-    return mon;
-}
+    /* We divide by the increments, so ignore silly ones. */
+    if (hints->flags & XCB_ICCCM_SIZE_HINT_P_RESIZE_INC
+        && hints->width_inc > 0 && hints->height_inc > 0)
+    {
+        client->width_inc = hints->width_inc;
+        client->height_inc = hints->height_inc;
 
-/* Raise window win to top of stack. */
-void raisewindow(xcb_drawable_t win)
-{
-    uint32_t values[] = { XCB_STACK_MODE_ABOVE };
+        PDEBUG("widht_inc %d\nheight_inc %d\n", client->width_inc,
+               client->height_inc);
+    }
 
-    if (screen->root == win || 0 == win)
+    if (hints->flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE)
     {
-        return;
+        client->base_width = hints->base_width;
+        client->base_height = hints->base_height;
     }
-
-    xcb_configure_window(conn, win,
-                         XCB_CONFIG_WINDOW_STACK_MODE,
-                         values);
-    xcb_flush(conn);
 }
 
 /*
- * Set window client to either top or bottom of stack depending on
- * where it is now.
+ * Get a keycode from a keysym.
+ *
+ * Returns keycode value.
  */
-void raiseorlower(struct client *client)
+xcb_keycode_t keysymtokeycode(xcb_keysym_t keysym, xcb_key_symbols_t *keysyms)
 {
-    uint32_t values[] = { XCB_STACK_MODE_OPPOSITE };
-    xcb_drawable_t win;
+    xcb_keycode_t *keyp;
+    xcb_keycode_t key;
 
-    if (NULL == client)
+    /* We only use the first keysymbol, even if there are more. */
+    keyp = xcb_key_symbols_get_keycode(keysyms, keysym);
+    if (NULL == keyp)
     {
-        return;
+        fprintf(stderr, "mcwm: Couldn't look up key. Exiting.\n");
+        exit(1);
+        return 0;
     }
 
-    win = client->id;
+    key = *keyp;
+    free(keyp);
 
-    xcb_configure_window(conn, win,
-                         XCB_CONFIG_WINDOW_STACK_MODE,
-                         values);
-    xcb_flush(conn);
+    return key;
 }
 
-void movelim(struct client *client)
+/*
+ * Set up all shortcut keys.
+ *
+ * Returns 0 on success, non-zero otherwise.
+ */
+int setupkeys(void)
 {
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
+    xcb_key_symbols_t *keysyms;
+    unsigned i;
 
-    if (NULL == client->monitor)
-    {
-        mon_x = 0;
-        mon_y = 0;
-        mon_width = screen->width_in_pixels;
-        mon_height = screen->height_in_pixels;
-    }
-    else
-    {
-        mon_x = client->monitor->x;
-        mon_y = client->monitor->y;
-        mon_width = client->monitor->width;
-        mon_height = client->monitor->height;
-    }
+    /* Get all the keysymbols. */
+    keysyms = xcb_key_symbols_alloc(conn);
 
-    /* Is it outside the physical monitor? */
-    if (client->x < mon_x)
+    /*
+     * Find out what keys generates our MODKEY mask. Unfortunately it
+     * might be several keys.
+     */
+    if (NULL != modkeys.keycodes)
     {
-        client->x = mon_x;
+        free(modkeys.keycodes);
     }
-    if (client->y < mon_y)
+    modkeys = getmodkeys(MODKEY);
+
+    if (0 == modkeys.len)
     {
-        client->y = mon_y;
+        fprintf(stderr, "We couldn't find any keycodes to our main modifier "
+                "key!\n");
+        return -1;
     }
 
-    if (client->x + client->width > mon_x + mon_width - conf.borderwidth * 2)
+    for (i = 0; i < modkeys.len; i ++)
     {
-        client->x = (mon_x + mon_width - conf.borderwidth * 2) - client->width;
+        /*
+         * Grab the keys that are bound to MODKEY mask with any other
+         * modifier.
+         */
+        xcb_grab_key(conn, 1, screen->root, XCB_MOD_MASK_ANY,
+                     modkeys.keycodes[i],
+                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
     }
 
-    if (client->y + client->height > mon_y + mon_height - conf.borderwidth * 2)
+    /* Now grab the rest of the keys with the MODKEY modifier. */
+    for (i = KEY_F; i < KEY_MAX; i ++)
     {
-        client->y = (mon_y + mon_height - conf.borderwidth * 2)
-            - client->height;
-    }
+        if (XK_VoidSymbol == keys[i].keysym)
+        {
+            keys[i].keycode = 0;
+            continue;
+        }
 
-    movewindow(client->id, client->x, client->y);
-}
+        keys[i].keycode = keysymtokeycode(keys[i].keysym, keysyms);
+        if (0 == keys[i].keycode)
+        {
+            /* Couldn't set up keys! */
 
-/* Move window win to root coordinates x,y. */
-void movewindow(xcb_drawable_t win, uint16_t x, uint16_t y)
-{
-    uint32_t values[2];
+            /* Get rid of key symbols. */
+            xcb_key_symbols_free(keysyms);
 
-    if (screen->root == win || 0 == win)
-    {
-        /* Can't move root. */
-        return;
-    }
+            return -1;
+        }
 
-    values[0] = x;
-    values[1] = y;
+        /* Grab other keys with a modifier mask. */
+        xcb_grab_key(conn, 1, screen->root, MODKEY, keys[i].keycode,
+                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
 
-    xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_X
-                         | XCB_CONFIG_WINDOW_Y, values);
+        /*
+         * XXX Also grab it's shifted counterpart. A bit ugly here
+         * because we grab all of them not just the ones we want.
+         */
+        xcb_grab_key(conn, 1, screen->root, MODKEY | SHIFTMOD,
+                     keys[i].keycode,
+                     XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+    }
 
-    xcb_flush(conn);
+    /* Get rid of the key symbols table. */
+    xcb_key_symbols_free(keysyms);
+
+    return 0;
 }
 
-/* Change focus to next in window ring. */
-void focusnext(bool reverse)
+/*
+ * Walk through all existing windows and set them up.
+ *
+ * We first ask for everything we need to know about every window and
+ * then go through the replies, so it costs about one round trip no
+ * matter how many windows there are.
+ *
+ * Returns 0 on success.
+ */
+int setupscreen(void)
 {
-    struct client *client = NULL;
+    xcb_query_tree_reply_t *reply;
+    xcb_query_pointer_cookie_t pointercookie;
+    int i;
+    int len;
+    xcb_window_t *children;
+    struct
+    {
+        xcb_get_window_attributes_cookie_t attr;
+        xcb_get_geometry_cookie_t geom;
+        xcb_get_property_cookie_t hints;
+        xcb_get_property_cookie_t desktop;
+    } *cookies;
+    xcb_get_window_attributes_reply_t *attr;
+    xcb_get_geometry_reply_t *geomreply;
+    xcb_get_property_reply_t *desktop;
+    struct client *client;
+    struct stackwin *stackwin;
+    struct sizepos geom;
+    xcb_size_hints_t hints;
+    uint32_t ws;
+    xcb_void_cookie_t cookie;
+    uint64_t start;
 
-#if DEBUG
-    if (NULL != focuswin)
+    start = microseconds();
+
+    /* Get all children. */
+    reply = xcb_query_tree_reply(conn,
+                                 xcb_query_tree(conn, screen->root), 0);
+    if (NULL == reply)
     {
-        PDEBUG("Focus now in win %d\n", focuswin->id);
+        return -1;
     }
-#endif
 
-    if (NULL == wslist[curws])
+    len = xcb_query_tree_children_length(reply);
+    children = xcb_query_tree_children(reply);
+
+    if (NULL == (cookies = malloc(sizeof (*cookies) * (len + 1))))
     {
-        PDEBUG("No windows to focus on in this workspace.\n");
-        return;
+        free(reply);
+        return -1;
     }
 
-    if (MCWM_TABBING != mode)
+    /* Ask for everything about all windows on this root... */
+    for (i = 0; i < len; i ++)
     {
-        /*
-         * Remember what we last focused on. We need this when the
-         * MODKEY is released and we move the last focused window in
-         * the tabbing order list.
-         */
-        lastfocuswin = focuswin;
-        mode = MCWM_TABBING;
-
-        PDEBUG("Began tabbing.\n");
+        cookies[i].attr = xcb_get_window_attributes(conn, children[i]);
+        cookies[i].geom = xcb_get_geometry(conn, children[i]);
+        cookies[i].hints
+            = xcb_icccm_get_wm_normal_hints_unchecked(conn, children[i]);
+        cookies[i].desktop = xcb_get_property(conn, false, children[i],
+                                              atom_desktop,
+                                              XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                              sizeof (int32_t));
     }
 
-    /* If we currently have no focus focus first in list. */
-    if (NULL == focuswin || NULL == focuswin->wsitem[curws])
+    /* ...and set them up as the answers come in. */
+    for (i = 0; i < len; i ++)
     {
-        PDEBUG("Focusing first in list: %p\n", wslist[curws]);
-        client = wslist[curws]->data;
+        attr = xcb_get_window_attributes_reply(conn, cookies[i].attr, NULL);
+        geomreply = xcb_get_geometry_reply(conn, cookies[i].geom, NULL);
 
-        if (NULL != focuswin && NULL == focuswin->wsitem[curws])
+        if (!attr)
         {
-            PDEBUG("XXX Our focused window %d isn't on this workspace!\n",
-                   focuswin->id);
+            fprintf(stderr, "Couldn't get attributes for window %d.",
+                    children[i]);
+            free(geomreply);
+            xcb_discard_reply(conn, cookies[i].hints.sequence);
+            xcb_discard_reply(conn, cookies[i].desktop.sequence);
+            continue;
         }
-    }
-    else
-    {
-        if (reverse)
+
+        /*
+         * Children come bottom first, so each one goes on top of the
+         * ones before.
+         */
+        if (NULL != (stackwin = addstack(children[i])))
         {
-            if (NULL == focuswin->wsitem[curws]->prev)
+            stackwin->mapped = XCB_MAP_STATE_UNMAPPED != attr->map_state;
+        }
+
+        /*
+         * Don't set up or even bother windows in override redirect
+         * mode.
+         *
+         * This mode means they wouldn't have been reported to us
+         * with a MapRequest if we had been running, so in the
+         * normal case we wouldn't have seen them.
+         *
+         * Only handle visible windows.
+         */
+        if (attr->override_redirect
+            || attr->map_state != XCB_MAP_STATE_VIEWABLE)
+        {
+            free(geomreply);
+            xcb_discard_reply(conn, cookies[i].hints.sequence);
+            xcb_discard_reply(conn, cookies[i].desktop.sequence);
+        }
+        else
+        {
+            if (NULL == geomreply)
             {
-                /*
-                 * We were at the head of list. Focusing on last
-                 * window in list unless we were already there.
-                 */
-                struct item *last = wslist[curws];
-                while (NULL != last->next)
-                    last = last->next;
-                if (focuswin->wsitem[curws] != last->data)
-                {
-                    PDEBUG("Beginning of list. Focusing last in list: %p\n",
-                           last);
-                    client = last->data;
-                }
+                fprintf(stderr, "Couldn't get geometry in initial setup of "
+                        "window.\n");
+                xcb_discard_reply(conn, cookies[i].hints.sequence);
+                xcb_discard_reply(conn, cookies[i].desktop.sequence);
+                free(attr);
+                continue;
+            }
+
+            geom.x = geomreply->x;
+            geom.y = geomreply->y;
+            geom.width = geomreply->width;
+            geom.height = geomreply->height;
+            free(geomreply);
+
+            /* Get the window's incremental size step, if any. */
+            if (!xcb_icccm_get_wm_normal_hints_reply(
+                    conn, cookies[i].hints, &hints, NULL))
+            {
+                PDEBUG("Couldn't get size hints.\n");
+                client = setupwin(children[i], &geom, NULL);
             }
             else
             {
-                /* Otherwise, focus the next in list. */
-                PDEBUG("Tabbing. Focusing next: %p.\n",
-                       focuswin->wsitem[curws]->prev);
-                client = focuswin->wsitem[curws]->prev->data;
+                client = setupwin(children[i], &geom, &hints);
             }
-        }
-        else
-        {
-            if (NULL == focuswin->wsitem[curws]->next)
+
+            if (NULL != client)
             {
                 /*
-                 * We were at the end of list. Focusing on first window in
-                 * list unless we were already there.
+                 * Find the physical output this window will be on if
+                 * RANDR is active.
                  */
-                if (focuswin->wsitem[curws] != wslist[curws]->data)
+                if (-1 != randrbase)
                 {
-                    PDEBUG("End of list. Focusing first in list: %p\n",
-                           wslist[curws]);
-                    client = wslist[curws]->data;
+                    PDEBUG("Looking for monitor on %d x %d.\n", client->x,
+                        client->y);
+                    client->monitor = findmonbycoord(client->x, client->y);
+#if DEBUG
+                    if (NULL != client->monitor)
+                    {
+                        PDEBUG("Found client on monitor %s.\n",
+                               client->monitor->name);
+                    }
+                    else
+                    {
+                        PDEBUG("Couldn't find client on any monitor.\n");
+                    }
+#endif
+                }
+
+                /* Fit window on physical screen. */
+                fitonscreen(client);
+
+                /*
+                 * Check if this window has a workspace set already as
+                 * a WM hint.
+                 *
+                 */
+                desktop = xcb_get_property_reply(conn, cookies[i].desktop,
+                                                 NULL);
+                ws = desktopfromreply(desktop);
+                free(desktop);
+                client->props.desktop = ws;
+                stats.adopted ++;
+
+                /* Fill in the rest of the property cache later. */
+                fetchprop(client->id, XCB_ATOM_WM_HINTS);
+                fetchprop(client->id, wm_protocols);
+                fetchprop(client->id, net_wm_sync_request_counter);
+                fetchprop(client->id, XCB_ATOM_WM_TRANSIENT_FOR);
+                fetchprop(client->id, XCB_ATOM_WM_CLASS);
+                fetchprop(client->id, XCB_ATOM_WM_NAME);
+                fetchprop(client->id, XCB_ATOM_WM_ICON_NAME);
+
+                if (ws == NET_WM_FIXED)
+                {
+                    /* Add to current workspace. */
+                    addtoworkspace(client, curws);
+                    /* Add to all other workspaces. */
+                    fixwindow(client, false);
+                }
+                else if (MCWM_NOWS != ws && ws < WORKSPACES)
+                {
+                    addtoworkspace(client, ws);
+                    /* If it's not our current workspace, hide it. */
+                    if (ws != curws)
+                    {
+                        cookie = xcb_unmap_window(conn, client->id);
+                        expectecho(cookie.sequence, XCB_UNMAP_NOTIFY,
+                                   client->id);
+                    }
+                }
+                else
+                {
+                    /*
+                     * No workspace hint at all. Just add it to our
+                     * current workspace.
+                     */
+                    addtoworkspace(client, curws);
                 }
             }
             else
             {
-                /* Otherwise, focus the next in list. */
-                PDEBUG("Tabbing. Focusing next: %p.\n",
-                       focuswin->wsitem[curws]->next);
-                client = focuswin->wsitem[curws]->next->data;
+                xcb_discard_reply(conn, cookies[i].desktop.sequence);
             }
         }
+
+        free(attr);
     }
 
-    if (NULL != client)
+    free(cookies);
+
+    changeworkspace(0);
+
+    /*
+     * Get pointer position so we can set focus on any window which
+     * might be under it. We do that in initpointerreply().
+     */
+    focuswin = NULL;
+    pointercookie = xcb_query_pointer(conn, screen->root);
+    expectreply(pointercookie.sequence, initpointerreply, NULL);
+
+    free(reply);
+
+    stats.startup = microseconds() - start;
+    PDEBUG("Adopted %llu windows in %llu us.\n",
+           (unsigned long long) stats.adopted,
+           (unsigned long long) stats.startup);
+
+    return 0;
+}
+
+/*
+ * The pointer position we asked for at startup arrived. Focus the
+ * window under the pointer, if any.
+ */
+void initpointerreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_query_pointer_reply_t *pointer = reply;
+    struct client *client;
+
+    if (NULL == pointer)
     {
-        /*
-         * Raise window if it's occluded, then warp pointer into it and
-         * set keyboard focus to it.
-         */
-        uint32_t values[] = { XCB_STACK_MODE_TOP_IF };
+        return;
+    }
+
+    /* Unless an event or a warp already told us more. */
+    if (!pointerpos.known)
+    {
+        setpointer(pointer->root_x, pointer->root_y, pointerpos.sequence);
+    }
 
-        xcb_configure_window(conn, client->id, XCB_CONFIG_WINDOW_STACK_MODE,
-                             values);
-        xcb_warp_pointer(conn, XCB_NONE, client->id, 0, 0, 0, 0,
-                         client->width / 2, client->height / 2);
+    if (NULL == focuswin && NULL != (client = findclient(pointer->child)))
+    {
         setfocus(client);
     }
 }
 
-/* Mark window win as unfocused. */
-void setunfocus(xcb_drawable_t win)
+/*
+ * Set up RANDR extension. Get the extension base and subscribe to
+ * events.
+ */
+int setuprandr(void)
 {
-    uint32_t values[1];
+    const xcb_query_extension_reply_t *extension;
+    xcb_randr_query_version_reply_t *version;
+    int base;
 
-    if (NULL == focuswin)
+    extension = xcb_get_extension_data(conn, &xcb_randr_id);
+    if (!extension->present)
     {
-        return;
+        PDEBUG("No RANDR extension.\n");
+        return -1;
     }
 
-    if (focuswin->id == screen->root)
+    /* With RANDR 1.5 the server keeps track of monitors for us. */
+    version = xcb_randr_query_version_reply(
+        conn, xcb_randr_query_version(conn, 1, 5), NULL);
+    if (NULL != version)
     {
-        return;
+        PDEBUG("RANDR version %u.%u.\n", version->major_version,
+               version->minor_version);
+        randrmonitors = version->major_version > 1
+            || (1 == version->major_version && version->minor_version >= 5);
+        free(version);
     }
 
-    /* Set new border colour. */
-    values[0] = conf.unfocuscol;
-    xcb_change_window_attributes(conn, win, XCB_CW_BORDER_PIXEL, values);
+    getrandr();
 
-    xcb_flush(conn);
+    base = extension->first_event;
+    PDEBUG("randrbase is %d.\n", base);
+
+    sethandler(base + XCB_RANDR_SCREEN_CHANGE_NOTIFY,
+               handle_randrscreenchange, "RRScreenChangeNotify");
+
+    xcb_randr_select_input(conn, screen->root,
+                           XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                           XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE |
+                           XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                           XCB_RANDR_NOTIFY_MASK_OUTPUT_PROPERTY);
+
+    return base;
 }
 
 /*
- * Find client with client->id win in global window list.
+ * Set up the SYNC extension so we can wait for clients to redraw
+ * when resizing them.
  *
- * Returns client pointer or NULL if not found.
+ * Returns the base for SYNC events or -1 if there's no SYNC.
  */
-struct client *findclient(xcb_drawable_t win)
+int setupsync(void)
 {
-    struct item *item;
-    struct client *client;
+    const xcb_query_extension_reply_t *extension;
+    xcb_sync_initialize_cookie_t cookie;
+    int base;
 
-    for (item = winlist; item != NULL; item = item->next)
+    extension = xcb_get_extension_data(conn, &xcb_sync_id);
+    if (!extension->present)
     {
-        client = item->data;
-        if (win == client->id)
-        {
-            PDEBUG("findclient: Found it. Win: %d\n", client->id);
-            return client;
-        }
+        PDEBUG("No SYNC extension.\n");
+        return -1;
     }
 
-    return NULL;
+    /* We don't care which version we get. We use very little. */
+    cookie = xcb_sync_initialize(conn, XCB_SYNC_MAJOR_VERSION,
+                                 XCB_SYNC_MINOR_VERSION);
+    xcb_discard_reply(conn, cookie.sequence);
+
+    base = extension->first_event;
+    PDEBUG("syncbase is %d.\n", base);
+
+    sethandler(base + XCB_SYNC_ALARM_NOTIFY, handle_syncalarm,
+               "SyncAlarmNotify");
+
+    return base;
 }
 
-/* Set focus on window client. */
-void setfocus(struct client *client)
+/*
+ * Start over with the sync counter client has in its property cache,
+ * if any. We need to know the counter's value before we can ask the
+ * client to go past it, so ask for that.
+ */
+void resetsync(struct client *client)
 {
-    uint32_t values[1];
-
-    /*
-     * If client is NULL, we focus on whatever the pointer is on.
-     *
-     * This is a pathological case, but it will make the poor user
-     * able to focus on windows anyway, even though this window
-     * manager might be buggy.
-     */
-    if (NULL == client)
-    {
-        PDEBUG("setfocus: client was NULL!\n");
+    xcb_sync_query_counter_cookie_t cookie;
 
-        focuswin = NULL;
+    freesync(client);
 
-        xcb_set_input_focus(conn, XCB_NONE, XCB_INPUT_FOCUS_POINTER_ROOT,
-                            XCB_CURRENT_TIME);
-        xcb_flush(conn);
+    client->sync.counter = client->props.synccounter;
+    client->sync.known = false;
+    client->sync.waiting = false;
+    client->sync.unresponsive = false;
 
-        return;
-    }
+    /* Nothing to wait for anymore. */
+    replaysteps(client);
 
-    /*
-     * Don't bother focusing on the root window or on the same window
-     * that already has focus.
-     */
-    if (client->id == screen->root || client == focuswin)
+    if (-1 == syncbase || XCB_NONE == client->sync.counter)
     {
         return;
     }
 
-    /* Set new border colour. */
-    if (client->fixed)
+    cookie = xcb_sync_query_counter(conn, client->sync.counter);
+    expectreply(cookie.sequence, counterreply,
+                (void *) (uintptr_t) client->id);
+}
+
+/* Forget the server resources and timer we use to sync with client. */
+void freesync(struct client *client)
+{
+    if (XCB_NONE != client->sync.alarm)
     {
-        values[0] = conf.fixedcol;
+        xcb_sync_destroy_alarm(conn, client->sync.alarm);
+        client->sync.alarm = XCB_NONE;
     }
-    else
+
+    if (NULL != client->sync.timer)
     {
-        values[0] = conf.focuscol;
+        deltimer(client->sync.timer);
+        client->sync.timer = NULL;
     }
+}
 
-    xcb_change_window_attributes(conn, client->id, XCB_CW_BORDER_PIXEL,
-                                 values);
+/* The value of a client's sync counter arrived. */
+void counterreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_sync_query_counter_reply_t *counter = reply;
+    struct client *client;
 
-    /* Unset last focus. */
-    if (NULL != focuswin)
+    if (NULL == (client = findclient((uintptr_t) data)))
     {
-        setunfocus(focuswin->id);
+        return;
     }
 
-    /* Set new input focus. */
-
-    xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT, client->id,
-                        XCB_CURRENT_TIME);
+    if (NULL == counter)
+    {
+        PDEBUG("Couldn't get sync counter of %d.\n", client->id);
+        return;
+    }
 
-    xcb_flush(conn);
+    client->sync.value = ((int64_t) counter->counter_value.hi << 32)
+        | counter->counter_value.lo;
+    client->sync.known = true;
+}
 
-    /* Remember the new window as the current focused window. */
-    focuswin = client;
+/*
+ * Returns true if we asked client to sync up with a new size and it
+ * hasn't yet. Don't send it another one until it has.
+ */
+bool syncwaiting(struct client *client)
+{
+    return client->sync.waiting;
 }
 
-int start(char *program)
+/*
+ * We're about to send client a new size while resizing it
+ * interactively. If it speaks
+ * _NET_WM_SYNC_REQUEST, ask it to tell us when it has handled the
+ * new size by setting its counter to a new value. The alarm tells us
+ * when it gets there.
+ */
+void syncrequest(struct client *client)
 {
-    pid_t pid;
+    uint32_t values[8];
+    uint32_t hi;
+    uint32_t lo;
 
-    pid = fork();
-    if (-1 == pid)
+    if (!client->props.syncrequest || !client->sync.known
+        || client->sync.unresponsive || XCB_NONE == client->sync.counter)
     {
-        perror("fork");
-        return -1;
+        return;
     }
-    else if (0 == pid)
-    {
-        char *argv[2];
 
-        /* In the child. */
+    client->sync.value ++;
+    hi = (uint64_t) client->sync.value >> 32;
+    lo = client->sync.value & 0xffffffff;
+
+    xcb_client_message_event_t ev = {
+      .response_type = XCB_CLIENT_MESSAGE,
+      .format = 32,
+      .sequence = 0,
+      .window = client->id,
+      .type = wm_protocols,
+      .data.data32 = { net_wm_sync_request, XCB_CURRENT_TIME, lo, hi }
+    };
+
+    xcb_send_event(conn, false, client->id, XCB_EVENT_MASK_NO_EVENT,
+                   (char *) &ev);
 
+    if (XCB_NONE == client->sync.alarm)
+    {
         /*
-         * Make this process a new process leader, otherwise the
-         * terminal will die when the wm dies. Also, this makes any
-         * SIGCHLD go to this process when we fork again.
+         * Fire once when the counter reaches the value, then go
+         * inactive until we change the value again.
          */
-        if (-1 == setsid())
-        {
-            perror("setsid");
-            exit(1);
-        }
+        client->sync.alarm = xcb_generate_id(conn);
+
+        values[0] = client->sync.counter;
+        values[1] = XCB_SYNC_VALUETYPE_ABSOLUTE;
+        values[2] = hi;
+        values[3] = lo;
+        values[4] = XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON;
+        values[5] = 0;
+        values[6] = 0;
+        values[7] = 1;
+
+        xcb_sync_create_alarm(conn, client->sync.alarm,
+                              XCB_SYNC_CA_COUNTER
+                              | XCB_SYNC_CA_VALUE_TYPE
+                              | XCB_SYNC_CA_VALUE
+                              | XCB_SYNC_CA_TEST_TYPE
+                              | XCB_SYNC_CA_DELTA
+                              | XCB_SYNC_CA_EVENTS, values);
+    }
+    else
+    {
+        values[0] = hi;
+        values[1] = lo;
 
-        argv[0] = program;
-        argv[1] = NULL;
+        xcb_sync_change_alarm(conn, client->sync.alarm, XCB_SYNC_CA_VALUE,
+                              values);
+    }
 
-        if (-1 == execvp(program, argv))
-        {
-            perror("execve");
-            exit(1);
-        }
-        exit(0);
+    client->sync.waiting = true;
+
+    if (NULL != client->sync.timer)
+    {
+        deltimer(client->sync.timer);
     }
+    client->sync.timer = addtimer(SYNC_TIMEOUT, synctimeout,
+                                  (void *) (uintptr_t) client->id);
 
-    return 0;
+    stats.syncrequests ++;
 }
 
-/* Resize with limit. */
-void resizelim(struct client *client)
+/*
+ * A client didn't catch up with a new size in time. Stop waiting for
+ * it and resize it the old way until it does.
+ */
+void synctimeout(void *data)
 {
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
+    struct client *client;
 
-    if (NULL == client->monitor)
+    if (NULL == (client = findclient((uintptr_t) data)))
     {
-        mon_x = 0;
-        mon_y = 0;
-        mon_width = screen->width_in_pixels;
-        mon_height = screen->height_in_pixels;
-    }
-    else
-    {
-        mon_x = client->monitor->x;
-        mon_y = client->monitor->y;
-        mon_width = client->monitor->width;
-        mon_height = client->monitor->height;
+        return;
     }
 
-    /* Is it smaller than it wants to  be? */
-    if (0 != client->min_height && client->height < client->min_height)
-    {
-        client->height = client->min_height;
-    }
+    PDEBUG("Client %d didn't sync in time.\n", client->id);
 
-    if (0 != client->min_width && client->width < client->min_width)
-    {
-        client->width = client->min_width;
-    }
+    client->sync.timer = NULL;
+    client->sync.waiting = false;
+    client->sync.unresponsive = true;
 
-    if (client->x + client->width + conf.borderwidth * 2 > mon_x + mon_width)
-    {
-        client->width = mon_width - ((client->x - mon_x) + conf.borderwidth
-                                     * 2);
-    }
+    stats.synctimeouts ++;
 
-    if (client->y + client->height + conf.borderwidth * 2 > mon_y + mon_height)
+    replaysteps(client);
+
+    if (MCWM_RESIZE == mode && client == focuswin)
     {
-        client->height = mon_height - ((client->y - mon_y) + conf.borderwidth
-                                       * 2);
+        applydrag();
     }
-
-    resize(client->id, client->width, client->height);
 }
 
-void moveresize(xcb_drawable_t win, uint16_t x, uint16_t y,
-                uint16_t width, uint16_t height)
+/*
+ * client has caught up, or we stopped waiting for it. Resize it by
+ * the keyboard steps we held back meanwhile. They all go out in the
+ * same configure.
+ */
+void replaysteps(struct client *client)
 {
-    uint32_t values[4];
+    const char *directions = "hjkl";
+    int steps;
+    int i;
 
-    if (screen->root == win || 0 == win)
+    for (i = 0; i < 4; i ++)
     {
-        /* Can't move or resize root. */
-        return;
+        if (0 != (steps = client->sync.held[i]))
+        {
+            client->sync.held[i] = 0;
+            resizestep(client, directions[i], steps);
+        }
     }
-
-    PDEBUG("Moving to %d, %d, resizing to %d x %d.\n", x, y, width, height);
-
-    values[0] = x;
-    values[1] = y;
-    values[2] = width;
-    values[3] = height;
-
-    xcb_configure_window(conn, win,
-                         XCB_CONFIG_WINDOW_X
-                         | XCB_CONFIG_WINDOW_Y
-                         | XCB_CONFIG_WINDOW_WIDTH
-                         | XCB_CONFIG_WINDOW_HEIGHT, values);
-    xcb_flush(conn);
 }
 
-/* Resize window win to width,height. */
-void resize(xcb_drawable_t win, uint16_t width, uint16_t height)
+/*
+ * Get RANDR resources and figure out how many outputs there are.
+ */
+void getrandr(void)
 {
-    uint32_t values[2];
+    xcb_randr_get_screen_resources_current_cookie_t rcookie;
+    xcb_randr_get_screen_resources_current_reply_t *res;
+    xcb_randr_output_t *outputs;
+    xcb_randr_mode_info_t *modes;
+    int len;
+    int nmodes;
+    xcb_timestamp_t timestamp;
 
-    if (screen->root == win || 0 == win)
+    if (randrmonitors && 0 == getmonitors())
     {
-        /* Can't resize root. */
         return;
     }
 
-    PDEBUG("Resizing to %d x %d.\n", width, height);
+    rcookie = xcb_randr_get_screen_resources_current(conn, screen->root);
+    res = xcb_randr_get_screen_resources_current_reply(conn, rcookie, NULL);
+    if (NULL == res)
+    {
+        printf("No RANDR extension available.\n");
+        return;
+    }
+    timestamp = res->config_timestamp;
 
-    values[0] = width;
-    values[1] = height;
+    len = xcb_randr_get_screen_resources_current_outputs_length(res);
+    outputs = xcb_randr_get_screen_resources_current_outputs(res);
 
-    xcb_configure_window(conn, win,
-                         XCB_CONFIG_WINDOW_WIDTH
-                         | XCB_CONFIG_WINDOW_HEIGHT, values);
-    xcb_flush(conn);
+    nmodes = xcb_randr_get_screen_resources_current_modes_length(res);
+    modes = xcb_randr_get_screen_resources_current_modes(res);
+
+    PDEBUG("Found %d outputs.\n", len);
+
+    /* Request information for all outputs. */
+    getoutputs(outputs, len, modes, nmodes, timestamp);
+
+    free(res);
 }
 
 /*
- * Resize window client in direction direction. Direction is:
- *
- * h = left, that is decrease width.
- *
- * j = down, that is, increase height.
+ * Get the monitors from RANDR 1.5. The server has already worked out
+ * clones, split displays and monitors the user defined, so we take
+ * them as they are.
  *
- * k = up, that is, decrease height.
+ * The layout and the screen resources come in one round trip. The
+ * CRTCs, for refresh rates, and the names of monitors we haven't seen
+ * before come in a second.
  *
- * l = right, that is, increase width.
+ * Returns 0 on success, -1 if we have to look at outputs instead.
  */
-void resizestep(struct client *client, char direction)
+int getmonitors(void)
 {
-    int step_x = MOVE_STEP;
-    int step_y = MOVE_STEP;
+    xcb_randr_get_monitors_cookie_t mcookie;
+    xcb_randr_get_monitors_reply_t *reply;
+    xcb_randr_get_screen_resources_current_cookie_t rcookie;
+    xcb_randr_get_screen_resources_current_reply_t *res;
+    xcb_randr_monitor_info_iterator_t iter;
+    xcb_randr_monitor_info_t *info;
+    xcb_randr_crtc_t *crtcs;
+    xcb_randr_output_t *outputs;
+    xcb_get_atom_name_reply_t *atomname;
+    xcb_randr_get_crtc_info_cookie_t *ccookie = NULL;
+    xcb_randr_get_crtc_info_reply_t **crtc = NULL;
+    xcb_get_atom_name_cookie_t *ncookie;
+    bool *asked;
+    struct monitor *mon;
+    struct item *item;
+    struct item *next;
+    xcb_randr_mode_info_t *modes = NULL;
+    uint32_t refresh;
+    char *name;
+    int ncrtcs = 0;
+    int nmodes = 0;
+    int nmons;
+    int i;
+    int j;
+    int k;
 
-    if (NULL == client)
+    mcookie = xcb_randr_get_monitors(conn, screen->root, 1);
+    rcookie = xcb_randr_get_screen_resources_current(conn, screen->root);
+
+    reply = xcb_randr_get_monitors_reply(conn, mcookie, NULL);
+    if (NULL == reply)
     {
-        return;
+        PDEBUG("Couldn't get monitors. Looking at outputs.\n");
+        xcb_discard_reply(conn, rcookie.sequence);
+        return -1;
     }
 
-    if (client->maxed)
+    res = xcb_randr_get_screen_resources_current_reply(conn, rcookie, NULL);
+    if (NULL != res)
     {
-        /* Can't resize a fully maximized window. */
-        return;
+        ncrtcs = xcb_randr_get_screen_resources_current_crtcs_length(res);
+        nmodes = xcb_randr_get_screen_resources_current_modes_length(res);
+        modes = xcb_randr_get_screen_resources_current_modes(res);
     }
 
-    raisewindow(client->id);
+    nmons = xcb_randr_get_monitors_monitors_length(reply);
 
-    if (client->width_inc > 1)
-    {
-        step_x = client->width_inc;
-    }
-    else
-    {
-        step_x = MOVE_STEP;
-    }
+    PDEBUG("Found %d monitors.\n", nmons);
 
-    if (client->height_inc > 1)
+    /*
+     * No monitors at all is odd. Don't drop every monitor we know
+     * because of it. See what the outputs say instead.
+     */
+    if (0 == nmons)
     {
-        step_y = client->height_inc;
+        free(res);
+        free(reply);
+        return -1;
     }
-    else
+
+    ncookie = malloc(sizeof (xcb_get_atom_name_cookie_t) * nmons);
+    asked = malloc(sizeof (bool) * nmons);
+    if (0 != ncrtcs)
     {
-        step_y = MOVE_STEP;
+        ccookie = malloc(sizeof (xcb_randr_get_crtc_info_cookie_t) * ncrtcs);
+        crtc = malloc(sizeof (xcb_randr_get_crtc_info_reply_t *) * ncrtcs);
     }
 
-    switch (direction)
+    if (NULL == ncookie || NULL == asked
+        || (0 != ncrtcs && (NULL == ccookie || NULL == crtc)))
     {
-    case 'h':
-        client->width = client->width - step_x;
-        break;
-
-    case 'j':
-        client->height = client->height + step_y;
-        break;
-
-    case 'k':
-        client->height = client->height - step_y;
-        break;
-
-    case 'l':
-        client->width = client->width + step_x;
-        break;
-
-    default:
-        PDEBUG("resizestep in unknown direction.\n");
-        break;
-    } /* switch direction */
+        fprintf(stderr, "mcwm: Out of memory.\n");
+        free(ncookie);
+        free(asked);
+        free(ccookie);
+        free(crtc);
+        free(res);
+        free(reply);
+        return -1;
+    }
 
-    resizelim(client);
+    dropothers(true);
 
-    /* If this window was vertically maximized, remember that it isn't now. */
-    if (client->vertmaxed)
+    /* Ask for all CRTCs and for the names of new monitors. */
+    if (NULL != res)
     {
-        client->vertmaxed = false;
+        crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+        for (i = 0; i < ncrtcs; i ++)
+        {
+            ccookie[i] = xcb_randr_get_crtc_info(conn, crtcs[i],
+                                                 res->config_timestamp);
+        }
     }
 
-    xcb_warp_pointer(conn, XCB_NONE, client->id, 0, 0, 0, 0,
-                     client->width / 2, client->height / 2);
-    xcb_flush(conn);
-}
-
-/*
- * Try to snap to other windows and monitor border
- */
-static void snapwindow(struct client *client, int snap_mode)
-{
-    struct item *item;
-    struct client *win;
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
-
-    if (NULL == client->monitor)
+    iter = xcb_randr_get_monitors_monitors_iterator(reply);
+    for (i = 0; iter.rem; i ++, xcb_randr_monitor_info_next(&iter))
     {
-        mon_x = 0;
-        mon_y = 0;
-        mon_width = screen->width_in_pixels;
-        mon_height = screen->height_in_pixels;
+        asked[i] = NULL == findmonitor(iter.data->name, true);
+        if (asked[i])
+        {
+            ncookie[i] = xcb_get_atom_name(conn, iter.data->name);
+        }
     }
-    else
+
+    for (i = 0; i < ncrtcs; i ++)
     {
-        mon_x = client->monitor->x;
-        mon_y = client->monitor->y;
-        mon_width = client->monitor->width;
-        mon_height = client->monitor->height;
+        crtc[i] = xcb_randr_get_crtc_info_reply(conn, ccookie[i], NULL);
     }
-    /*
-     * Go through all windows on current workspace.
-     */
-    for (item = wslist[curws]; item != NULL; item = item->next)
+
+    iter = xcb_randr_get_monitors_monitors_iterator(reply);
+    for (i = 0; iter.rem; i ++, xcb_randr_monitor_info_next(&iter))
     {
-        win = item->data;
+        info = iter.data;
 
-        if (client == win)
+        /*
+         * The refresh rate is that of the CRTC showing the
+         * monitor's first output.
+         */
+        refresh = 0;
+        if (xcb_randr_monitor_info_outputs_length(info) > 0)
         {
-            continue;
-        }
+            outputs = xcb_randr_monitor_info_outputs(info);
 
-        if (snap_mode == MCWM_MOVE)
-        {
-            if (abs((win->x +win->width) - client->x) < conf.snapmargin)
+            for (j = 0; j < ncrtcs && 0 == refresh; j ++)
             {
-                if (client->y + client->height > win->y
-                    && client->y < win->y + win->height)
+                if (NULL == crtc[j])
                 {
-                    client->x = (win->x + win->width) + (2 * conf.borderwidth);
+                    continue;
                 }
-            }
 
-            if (abs((win->y +win->height) - client->y) < conf.snapmargin)
-            {
-                if (client->x + client->width >win->x
-                    && client->x < win->x + win->width)
+                for (k = 0;
+                     k < xcb_randr_get_crtc_info_outputs_length(crtc[j]);
+                     k ++)
                 {
-                    client->y = (win->y + win->height) + (2 * conf.borderwidth);
+                    if (xcb_randr_get_crtc_info_outputs(crtc[j])[k]
+                        == outputs[0])
+                    {
+                        refresh = moderefresh(crtc[j]->mode, modes,
+                                              nmodes);
+                        break;
+                    }
                 }
             }
+        }
 
-            if (abs((client->x + client->width) - win->x) < conf.snapmargin)
-            {
-                if (client->y + client->height > win->y
-                    && client->y < win->y + win->height)
-                {
-                    client->x = (win->x - client->width)
-                        - (2 * conf.borderwidth);
-                }
-            }
+        if (!asked[i])
+        {
+            PDEBUG("Known monitor %d. Updating info.\n", info->name);
+            mon = findmonitor(info->name, true);
+            mon->refresh = refresh;
+            updatemonitor(mon, info->x, info->y, info->width,
+                          info->height);
+            continue;
+        }
 
-            if (abs((client->y + client->height) - win->y) < conf.snapmargin)
-            {
-                if (client->x + client->width >win->x
-                    && client->x < win->x + win->width)
-                {
-                    client->y = (win->y - client->height)
-                        - (2 * conf.borderwidth);
-                }
-            }
+        atomname = xcb_get_atom_name_reply(conn, ncookie[i], NULL);
+        if (NULL != atomname)
+        {
+            asprintf(&name, "%.*s",
+                     xcb_get_atom_name_name_length(atomname),
+                     xcb_get_atom_name_name(atomname));
+            free(atomname);
+        }
+        else
+        {
+            asprintf(&name, "monitor-%d", info->name);
+        }
 
-        } /* mcwm_move */
-        else if (snap_mode == MCWM_RESIZE)
+        PDEBUG("New monitor %s at %d, %d, size %d x %d, %u mHz.\n",
+               name, info->x, info->y, info->width, info->height,
+               refresh);
+
+        mon = addmonitor(info->name, name, info->x, info->y,
+                         info->width, info->height);
+        if (NULL == mon)
         {
-            if (abs((client->x + client->width) - win->x) < conf.snapmargin)
-            {
-                if (client->y + client->height > win->y
-                    && client->y < win->y + win->height)
-                {
-                    client->width = (win->x - client->x)
-                        - (2 * conf.borderwidth);
-                }
-            }
+            free(name);
+            continue;
+        }
 
-            if (abs((client->y + client->height) - win->y) < conf.snapmargin)
-            {
-                if (client->x + client->width >win->x
-                    && client->x < win->x + win->width)
-                {
-                    client->height = (win->y - client->y)
-                        - (2 * conf.borderwidth);
-                }
-            }
-        } /* mcwm_resize */
+        mon->randrmon = true;
+        mon->refresh = refresh;
     }
 
-    /* monitor border */
-    if (snap_mode == MCWM_MOVE) {
+    for (i = 0; i < ncrtcs; i ++)
+    {
+        free(crtc[i]);
+    }
 
-        if (abs(client->x - mon_x) < conf.snapmargin)
-        {
-            client->x = mon_x;
-        }
+    free(ncookie);
+    free(asked);
+    free(ccookie);
+    free(crtc);
 
-        if (abs(client->y - mon_y) < conf.snapmargin)
-        {
-            client->y = mon_y;
-        }
+    /* Forget the monitors that are gone. */
+    for (item = monlist; item != NULL; item = next)
+    {
+        next = item->next;
+        mon = item->data;
 
-        if (abs((client->x + client->width) - mon_width) < conf.snapmargin)
+        iter = xcb_randr_get_monitors_monitors_iterator(reply);
+        for (; iter.rem; xcb_randr_monitor_info_next(&iter))
         {
-            client->x = (mon_width - client->width);
+            if (iter.data->name == mon->id)
+            {
+                break;
+            }
         }
 
-        if (abs((client->y + client->height) - mon_height) < conf.snapmargin)
-        {
-            client->y = (mon_height - client->height);
-        }
-    }
-    else if (snap_mode == MCWM_RESIZE)
-    {
-        if (abs((client->width + client->x) - mon_width) < conf.snapmargin)
-        {
-            client->width = mon_width;
-        }
-        if (abs((client->height + client->y) - mon_height) < conf.snapmargin)
+        if (0 == iter.rem)
         {
-            client->height = mon_height;
+            PDEBUG("Monitor %s is gone.\n", mon->name);
+            dropmonitor(mon);
         }
     }
+
+    free(res);
+    free(reply);
+
+    return 0;
 }
 
 /*
- * Move window win as a result of pointer motion to coordinates
- * rel_x,rel_y.
+ * Find mode id among the nmodes modes and return its refresh rate in
+ * millihertz, or 0 if we can't tell.
  */
-void mousemove(struct client *client, int rel_x, int rel_y)
+uint32_t moderefresh(xcb_randr_mode_t id, xcb_randr_mode_info_t *modes,
+                     int nmodes)
 {
-    client->x = rel_x;
-    client->y = rel_y;
+    uint64_t dots;
+    uint64_t refresh;
+    int i;
 
-    if (conf.snapmargin > 0)
+    for (i = 0; i < nmodes; i ++)
     {
-        snapwindow(client, MCWM_MOVE);
-    }
-
-    movelim(client);
-}
-
-void mouseresize(struct client *client, int rel_x, int rel_y)
-{
+        if (modes[i].id != id)
+        {
+            continue;
+        }
 
-    client->width = abs(rel_x - client->x);
-    client->height = abs(rel_y - client->y);
+        dots = (uint64_t) modes[i].htotal * modes[i].vtotal;
+        if (0 == dots)
+        {
+            return 0;
+        }
 
-    client->width -= (client->width - client->base_width) % client->width_inc;
-    client->height -= (client->height - client->base_height)
-        % client->height_inc;
+        refresh = (uint64_t) modes[i].dot_clock * 1000 / dots;
 
-    PDEBUG("Trying to resize to %dx%d (%dx%d)\n", client->width, client->height,
-           (client->width - client->base_width) / client->width_inc,
-           (client->height - client->base_height) / client->height_inc);
+        if (modes[i].mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE)
+        {
+            refresh *= 2;
+        }
+        if (modes[i].mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN)
+        {
+            refresh /= 2;
+        }
 
-    if (conf.snapmargin > 0)
-    {
-        snapwindow(client, MCWM_RESIZE);
+        return refresh;
     }
 
-    resizelim(client);
-
-    /* If this window was vertically maximized, remember that it isn't now. */
-    if (client->vertmaxed)
-    {
-        client->vertmaxed = false;
-    }
+    return 0;
 }
 
-void movestep(struct client *client, char direction)
+/*
+ * Walk through all the RANDR outputs (number of outputs == len) there
+ * was at time timestamp. The nmodes modes are the ones the screen
+ * resources told us about.
+ *
+ * All output info requests go out at once, and then all CRTC info
+ * requests for the outputs in use, so this costs two round trips no
+ * matter how many outputs there are.
+ */
+void getoutputs(xcb_randr_output_t *outputs, int len,
+                xcb_randr_mode_info_t *modes, int nmodes,
+                xcb_timestamp_t timestamp)
 {
-    int16_t start_x;
-    int16_t start_y;
+    char *name;
+    xcb_randr_get_crtc_info_reply_t *crtc = NULL;
+    xcb_randr_get_output_info_reply_t *output;
+    struct monitor *mon;
+    struct monitor *clonemon;
+    uint32_t refresh;
+    xcb_randr_get_output_info_cookie_t *ocookie;
+    xcb_randr_get_output_info_reply_t **outputinfo;
+    xcb_randr_get_crtc_info_cookie_t *icookie;
+    int i;
 
-    if (NULL == client)
+    dropothers(false);
+
+    if (0 == len)
     {
         return;
     }
 
-    if (client->maxed)
+    ocookie = malloc(sizeof (xcb_randr_get_output_info_cookie_t) * len);
+    outputinfo = malloc(sizeof (xcb_randr_get_output_info_reply_t *) * len);
+    icookie = malloc(sizeof (xcb_randr_get_crtc_info_cookie_t) * len);
+    if (NULL == ocookie || NULL == outputinfo || NULL == icookie)
     {
-        /* We can't move a fully maximized window. */
+        fprintf(stderr, "mcwm: Out of memory.\n");
+        free(ocookie);
+        free(outputinfo);
+        free(icookie);
         return;
     }
 
-    /* Save pointer position so we can warp pointer here later. */
-    if (!getpointer(client->id, &start_x, &start_y))
+    for (i = 0; i < len; i++)
     {
-        return;
+        ocookie[i] = xcb_randr_get_output_info(conn, outputs[i], timestamp);
     }
 
-    raisewindow(client->id);
-    switch (direction)
+    /* Ask for the CRTCs of all outputs in use as their info arrives. */
+    for (i = 0; i < len; i++)
     {
-    case 'h':
-        client->x = client->x - MOVE_STEP;
-        break;
-
-    case 'j':
-        client->y = client->y + MOVE_STEP;
-        break;
-
-    case 'k':
-        client->y = client->y - MOVE_STEP;
-        break;
+        outputinfo[i] = xcb_randr_get_output_info_reply(conn, ocookie[i],
+                                                        NULL);
+        if (NULL != outputinfo[i] && XCB_NONE != outputinfo[i]->crtc)
+        {
+            icookie[i] = xcb_randr_get_crtc_info(conn, outputinfo[i]->crtc,
+                                                 timestamp);
+        }
+    }
 
-    case 'l':
-        client->x = client->x + MOVE_STEP;
-        break;
+    /* Loop through all outputs. */
+    for (i = 0; i < len; i ++)
+    {
+        output = outputinfo[i];
 
-    default:
-        PDEBUG("movestep: Moving in unknown direction.\n");
-        break;
-    } /* switch direction */
+        if (output == NULL)
+        {
+            continue;
+        }
 
-    movelim(client);
+        asprintf(&name, "%.*s",
+                 xcb_randr_get_output_info_name_length(output),
+                 xcb_randr_get_output_info_name(output));
 
-    /*
-     * If the pointer was inside the window to begin with, move
-     * pointer back to where it was, relative to the window.
-     */
-    if (start_x > 0 - conf.borderwidth && start_x < client->width
-        + conf.borderwidth && start_y > 0 - conf.borderwidth && start_y
-        < client->height + conf.borderwidth)
-    {
-        xcb_warp_pointer(conn, XCB_NONE, client->id, 0, 0, 0, 0,
-                         start_x, start_y);
-        xcb_flush(conn);
-    }
-}
+        PDEBUG("Name: %s\n", name);
+        PDEBUG("id: %d\n" , outputs[i]);
+        PDEBUG("Size: %d x %d mm.\n", output->mm_width, output->mm_height);
 
-void setborders(struct client *client, int width)
-{
-    uint32_t values[1];
-    uint32_t mask = 0;
+        if (XCB_NONE != output->crtc)
+        {
+            crtc = xcb_randr_get_crtc_info_reply(conn, icookie[i], NULL);
+            if (NULL == crtc)
+            {
+                /* Probably changed again already. Skip just this one. */
+                PDEBUG("Couldn't get CRTC of output %s.\n", name);
+                free(name);
+                free(output);
+                continue;
+            }
 
-    values[0] = width;
+            PDEBUG("CRTC: at %d, %d, size: %d x %d.\n", crtc->x, crtc->y,
+                   crtc->width, crtc->height);
 
-    mask |= XCB_CONFIG_WINDOW_BORDER_WIDTH;
-    xcb_configure_window(conn, client->id, mask, &values[0]);
-    xcb_flush(conn);
-}
+            refresh = moderefresh(crtc->mode, modes, nmodes);
 
-void unmax(struct client *client)
-{
-    uint32_t values[5];
-    uint32_t mask = 0;
+            PDEBUG("Refresh rate: %u mHz.\n", refresh);
 
-    if (NULL == client)
-    {
-        PDEBUG("unmax: client was NULL!\n");
-        return;
-    }
+            /* Check if it's a clone. */
+            clonemon = findclones(outputs[i], crtc->x, crtc->y);
+            if (NULL != clonemon)
+            {
+                PDEBUG("Monitor %s, id %d is a clone of %s, id %d. Skipping.\n",
+                       name, outputs[i],
+                       clonemon->name, clonemon->id);
+                free(crtc);
+                free(name);
+                free(output);
+                continue;
+            }
 
-    client->x = client->origsize.x;
-    client->y = client->origsize.y;
-    client->width = client->origsize.width;
-    client->height = client->origsize.height;
+            /* Do we know this monitor already? */
+            if (NULL == (mon = findmonitor(outputs[i], false)))
+            {
+                PDEBUG("Monitor not known, adding to list.\n");
+                mon = addmonitor(outputs[i], name, crtc->x, crtc->y,
+                                 crtc->width, crtc->height);
+                if (NULL != mon)
+                {
+                    /* The monitor keeps the name. */
+                    mon->refresh = refresh;
+                    name = NULL;
+                }
+            }
+            else
+            {
+                PDEBUG("Known monitor. Updating info.\n");
 
-    /* Restore geometry. */
-    if (client->maxed)
-    {
-        values[0] = client->x;
-        values[1] = client->y;
-        values[2] = client->width;
-        values[3] = client->height;
+                /* A new refresh rate doesn't move any windows. */
+                mon->refresh = refresh;
 
-        /* Set borders again. */
-        values[4] = conf.borderwidth;
+                updatemonitor(mon, crtc->x, crtc->y, crtc->width,
+                              crtc->height);
+            }
 
-        mask =
-            XCB_CONFIG_WINDOW_X
-            | XCB_CONFIG_WINDOW_Y
-            | XCB_CONFIG_WINDOW_WIDTH
-            | XCB_CONFIG_WINDOW_HEIGHT
-            | XCB_CONFIG_WINDOW_BORDER_WIDTH;
-    }
-    else
-    {
-        values[0] = client->y;
-        values[1] = client->width;
-        values[2] = client->height;
+            free(crtc);
+        }
+        else
+        {
+            PDEBUG("Monitor not used at the moment.\n");
+            /*
+             * Check if it was used before. If it was, do something.
+             */
+            if ((mon = findmonitor(outputs[i], false)))
+            {
+                dropmonitor(mon);
+            }
+        }
 
-        mask = XCB_CONFIG_WINDOW_Y
-            | XCB_CONFIG_WINDOW_WIDTH
-            | XCB_CONFIG_WINDOW_HEIGHT;
+        free(name);
+        free(output);
     }
 
-    xcb_configure_window(conn, client->id, mask, values);
-
-    /* Warp pointer to window or we might lose it. */
-    xcb_warp_pointer(conn, XCB_NONE, client->id, 0, 0, 0, 0,
-                     client->width / 2, client->height / 2);
-
-    xcb_flush(conn);
+    free(ocookie);
+    free(outputinfo);
+    free(icookie);
 }
 
-void maximize(struct client *client)
+/*
+ * Monitor mon is now at x, y and width x height. If that's not where
+ * it was, rearrange the windows on it.
+ */
+void updatemonitor(struct monitor *mon, int16_t x, int16_t y,
+                   uint16_t width, uint16_t height)
 {
-    uint32_t values[4];
-    uint32_t mask = 0;
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
+    bool changed = false;
 
-    if (NULL == client)
+    if (x != mon->x)
     {
-        PDEBUG("maximize: client was NULL!\n");
-        return;
+        mon->x = x;
+        changed = true;
+    }
+    if (y != mon->y)
+    {
+        mon->y = y;
+        changed = true;
     }
 
-    if (NULL == client->monitor)
+    if (width != mon->width)
     {
-        mon_x = 0;
-        mon_y = 0;
-        mon_width = screen->width_in_pixels;
-        mon_height = screen->height_in_pixels;
+        mon->width = width;
+        changed = true;
     }
-    else
+    if (height != mon->height)
     {
-        mon_x = client->monitor->x;
-        mon_y = client->monitor->y;
-        mon_width = client->monitor->width;
-        mon_height = client->monitor->height;
+        mon->height = height;
+        changed = true;
     }
 
-    /*
-     * Check if maximized already. If so, revert to stored
-     * geometry.
-     */
-    if (client->maxed)
+    if (changed)
     {
-        unmax(client);
-        client->maxed = false;
-        return;
+        arrbymon(mon);
     }
+}
 
-    /* Raise first. Pretty silly to maximize below something else. */
-    raisewindow(client->id);
+/*
+ * Monitor mon isn't in use anymore. Move its windows elsewhere and
+ * forget about it.
+ */
+void dropmonitor(struct monitor *mon)
+{
+    struct item *item;
+    struct client *client;
 
-    /* FIXME: Store original geom in property as well? */
-    client->origsize.x = client->x;
-    client->origsize.y = client->y;
-    client->origsize.width = client->width;
-    client->origsize.height = client->height;
+    /* Check all windows on this monitor and move them to
+     * the next or to the first monitor if there is no
+     * next.
+     *
+     * FIXME: Use per monitor workspace list instead of
+     * global window list.
+     */
+    for (item = winlist; item != NULL; item = item->next)
+    {
+        client = item->data;
+        if (client->monitor == mon)
+        {
+            if (NULL == client->monitor->item->next)
+            {
+                if (NULL == monlist)
+                {
+                    client->monitor = NULL;
+                }
+                else
+                {
+                    client->monitor = monlist->data;
+                }
+            }
+            else
+            {
+                client->monitor =
+                    client->monitor->item->next->data;
+            }
 
-    /* Remove borders. */
-    values[0] = 0;
-    mask = XCB_CONFIG_WINDOW_BORDER_WIDTH;
-    xcb_configure_window(conn, client->id, mask, values);
+            fitonscreen(client);
+        }
+    }
 
-    /* Move to top left and resize. */
-    client->x = mon_x;
-    client->y = mon_y;
-    client->width = mon_width;
-    client->height = mon_height;
+    /* It's not active anymore. Forget about it. */
+    delmonitor(mon);
+}
 
-    values[0] = client->x;
-    values[1] = client->y;
-    values[2] = client->width;
-    values[3] = client->height;
-    xcb_configure_window(conn, client->id, XCB_CONFIG_WINDOW_X
-                         | XCB_CONFIG_WINDOW_Y
-                         | XCB_CONFIG_WINDOW_WIDTH
-                         | XCB_CONFIG_WINDOW_HEIGHT, values);
+void arrbymon(struct monitor *monitor)
+{
+    struct item *item;
+    struct client *client;
 
-    xcb_flush(conn);
+    PDEBUG("arrbymon\n");
+    /*
+     * Go through all windows on this monitor. If they don't fit on
+     * the new screen, move them around and resize them as necessary.
+     *
+     * FIXME: Use a per monitor workspace list instead of global
+     * windows list.
+     */
+    for (item = winlist; item != NULL; item = item->next)
+    {
+        client = item->data;
+        if (client->monitor == monitor)
+        {
+            fitonscreen(client);
+        }
+    }
 
-    client->maxed = true;
 }
 
-void maxvert(struct client *client)
+/*
+ * Find the monitor with id. randrmon says if id is a RANDR 1.5
+ * monitor name or an output.
+ */
+struct monitor *findmonitor(xcb_randr_output_t id, bool randrmon)
 {
-    uint32_t values[2];
-    int16_t mon_y;
-    uint16_t mon_height;
+    struct item *item;
+    struct monitor *mon;
 
-    if (NULL == client)
+    for (item = monlist; item != NULL; item = item->next)
     {
-        PDEBUG("maxvert: client was NULL\n");
-        return;
+        mon = item->data;
+        if (id == mon->id && randrmon == mon->randrmon)
+        {
+            PDEBUG("findmonitor: Found it. Output ID: %d\n", mon->id);
+            return mon;
+        }
+        PDEBUG("findmonitor: Goint to %p.\n", item->next);
     }
 
-    if (NULL == client->monitor)
-    {
-        mon_y = 0;
-        mon_height = screen->height_in_pixels;
-    }
-    else
-    {
-        mon_y = client->monitor->y;
-        mon_height = client->monitor->height;
-    }
+    return NULL;
+}
 
-    /*
-     * Check if maximized already. If so, revert to stored geometry.
-     */
-    if (client->vertmaxed)
+/*
+ * We're about to fill in the monitor list from RANDR 1.5 monitors if
+ * randrmon, otherwise from outputs. Forget the monitors the other way
+ * gave us, since we can't match them up.
+ */
+void dropothers(bool randrmon)
+{
+    struct item *item;
+    struct item *next;
+    struct monitor *mon;
+
+    for (item = monlist; item != NULL; item = next)
     {
-        unmax(client);
-        client->vertmaxed = false;
-        return;
-    }
+        next = item->next;
+        mon = item->data;
 
-    /* Raise first. Pretty silly to maximize below something else. */
-    raisewindow(client->id);
+        if (randrmon != mon->randrmon)
+        {
+            PDEBUG("Dropping monitor %s from the other RANDR path.\n",
+                   mon->name);
+            dropmonitor(mon);
+        }
+    }
+}
 
-    /*
-     * Store original coordinates and geometry.
-     * FIXME: Store in property as well?
-     */
-    client->origsize.x = client->x;
-    client->origsize.y = client->y;
-    client->origsize.width = client->width;
-    client->origsize.height = client->height;
+struct monitor *findclones(xcb_randr_output_t id, int16_t x, int16_t y)
+{
+    struct monitor *clonemon;
+    struct item *item;
 
-    client->y = mon_y;
-    /* Compute new height considering height increments and screen height. */
-    client->height = mon_height - conf.borderwidth * 2;
-    client->height -= (client->height - client->base_height)
-        % client->height_inc;
+    for (item = monlist; item != NULL; item = item->next)
+    {
+        clonemon = item->data;
 
-    /* Move to top of screen and resize. */
-    values[0] = client->y;
-    values[1] = client->height;
+        PDEBUG("Monitor %s: x, y: %d--%d, %d--%d.\n",
+               clonemon->name,
+               clonemon->x, clonemon->x + clonemon->width,
+               clonemon->y, clonemon->y + clonemon->height);
 
-    xcb_configure_window(conn, client->id, XCB_CONFIG_WINDOW_Y
-                         | XCB_CONFIG_WINDOW_HEIGHT, values);
-    xcb_flush(conn);
+        /* Check for same position. */
+        if (id != clonemon->id && clonemon->x == x && clonemon->y == y)
+        {
+            return clonemon;
+        }
+    }
 
-    /* Remember that this client is vertically maximized. */
-    client->vertmaxed = true;
+    return NULL;
 }
 
-void hide(struct client *client)
+struct monitor *findmonbycoord(int16_t x, int16_t y)
 {
-    long data[] = { XCB_ICCCM_WM_STATE_ICONIC, XCB_NONE };
+    struct item *item;
+    struct monitor *mon;
 
-    /*
-     * Unmap window and declare iconic.
-     *
-     * Unmapping will generate an UnmapNotify event so we can forget
-     * about the window later.
-     */
-    xcb_unmap_window(conn, client->id);
-    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, client->id,
-                        wm_state, wm_state, 32, 2, data);
-    xcb_flush(conn);
-}
+    for (item = monlist; item != NULL; item = item->next)
+    {
+        mon = item->data;
 
-bool getpointer(xcb_drawable_t win, int16_t *x, int16_t *y)
-{
-    xcb_query_pointer_reply_t *pointer;
+        PDEBUG("Monitor %s: x, y: %d--%d, %d--%d.\n",
+               mon->name,
+               mon->x, mon->x + mon->width,
+               mon->y, mon->y + mon->height);
 
-    pointer
-        = xcb_query_pointer_reply(conn, xcb_query_pointer(conn, win), 0);
-    if (NULL == pointer)
-    {
-        return false;
-    }
+        PDEBUG("Is %d,%d between them?\n", x, y);
 
-    *x = pointer->win_x;
-    *y = pointer->win_y;
+        if (x >= mon->x && x <= mon->x + mon->width
+            && y >= mon->y && y <= mon->y + mon->height)
+        {
+            PDEBUG("findmonbycoord: Found it. Output ID: %d, name %s\n",
+                   mon->id, mon->name);
+            return mon;
+        }
+    }
 
-    free(pointer);
+    return NULL;
+}
 
-    return true;
+void delmonitor(struct monitor *mon)
+{
+    PDEBUG("Deleting output %s.\n", mon->name);
+    free(mon->name);
+    freeitem(&monlist, NULL, mon->item);
 }
 
-bool getgeom(xcb_drawable_t win, int16_t *x, int16_t *y, uint16_t *width,
-             uint16_t *height)
+struct monitor *addmonitor(xcb_randr_output_t id, char *name,
+                           uint32_t x, uint32_t y, uint16_t width,
+                           uint16_t height)
 {
-    xcb_get_geometry_reply_t *geom;
+    struct item *item;
+    struct monitor *mon;
 
-    geom
-        = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, win), NULL);
-    if (NULL == geom)
+    if (NULL == (item = additem(&monlist)))
     {
-        return false;
+        fprintf(stderr, "Out of memory.\n");
+        return NULL;
     }
 
-    *x = geom->x;
-    *y = geom->y;
-    *width = geom->width;
-    *height = geom->height;
+    mon = malloc(sizeof (struct monitor));
+    if (NULL == mon)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return NULL;
+    }
 
-    free(geom);
+    item->data = mon;
 
-    return true;
+    mon->id = id;
+    mon->randrmon = false;
+    mon->name = name;
+    mon->x = x;
+    mon->y = y;
+    mon->width = width;
+    mon->height = height;
+    mon->refresh = 0;
+    mon->item = item;
+
+    return mon;
 }
 
-void topleft(void)
+/* Raise window win to top of stack. */
+void raisewindow(xcb_drawable_t win)
 {
-    int16_t pointx;
-    int16_t pointy;
-    int16_t mon_x;
-    int16_t mon_y;
+    uint32_t values[] = { XCB_STACK_MODE_ABOVE };
+    struct client *client;
 
-    if (NULL == focuswin)
+    if (screen->root == win || 0 == win)
     {
         return;
     }
 
-    if (NULL == focuswin->monitor)
+    if (NULL != (client = findclient(win)))
     {
-        mon_x = 0;
-        mon_y = 0;
+        stagestack(client, XCB_STACK_MODE_ABOVE, XCB_NONE);
+        return;
     }
-    else
+
+    if (stacknoop(win, XCB_STACK_MODE_ABOVE, XCB_NONE))
     {
-        mon_x = focuswin->monitor->x;
-        mon_y = focuswin->monitor->y;
+        stats.restackskipped ++;
+        return;
     }
 
-    raisewindow(focuswin->id);
+    configurewin(win,
+                 XCB_CONFIG_WINDOW_STACK_MODE,
+                 values);
+    restack(win, XCB_STACK_MODE_ABOVE, XCB_NONE);
+    stats.restacks ++;
+}
 
-    if (!getpointer(focuswin->id, &pointx, &pointy))
+/*
+ * Set window client to either top or bottom of stack depending on
+ * where it is now.
+ */
+void raiseorlower(struct client *client)
+{
+    if (NULL == client)
     {
         return;
     }
 
-    focuswin->x = mon_x;
-    focuswin->y = mon_y;
-    movewindow(focuswin->id, focuswin->x, focuswin->y);
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     pointx, pointy);
-    xcb_flush(conn);
+    stagestack(client, XCB_STACK_MODE_OPPOSITE, XCB_NONE);
 }
 
-void topright(void)
+void movelim(struct client *client)
 {
-    int16_t pointx;
-    int16_t pointy;
     int16_t mon_x;
-    uint16_t mon_y;
+    int16_t mon_y;
     uint16_t mon_width;
+    uint16_t mon_height;
 
-    if (NULL == focuswin)
+    if (NULL == client->monitor)
     {
-        return;
-    }
-
-    if (NULL == focuswin->monitor)
-    {
-        mon_width = screen->width_in_pixels;
         mon_x = 0;
         mon_y = 0;
+        mon_width = screen->width_in_pixels;
+        mon_height = screen->height_in_pixels;
     }
     else
     {
-        mon_width = focuswin->monitor->width;
-        mon_x = focuswin->monitor->x;
-        mon_y = focuswin->monitor->y;
+        mon_x = client->monitor->x;
+        mon_y = client->monitor->y;
+        mon_width = client->monitor->width;
+        mon_height = client->monitor->height;
     }
 
-    raisewindow(focuswin->id);
-
-    if (!getpointer(focuswin->id, &pointx, &pointy))
+    /* Is it outside the physical monitor? */
+    if (client->x < mon_x)
     {
-        return;
+        client->x = mon_x;
     }
-
-    focuswin->x = mon_x + mon_width -
-        (focuswin->width + conf.borderwidth * 2);
-
-    focuswin->y = mon_y;
-
-    movewindow(focuswin->id, focuswin->x, focuswin->y);
-
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     pointx, pointy);
-    xcb_flush(conn);
-}
-
-void botleft(void)
-{
-    int16_t pointx;
-    int16_t pointy;
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_height;
-
-    if (NULL == focuswin)
+    if (client->y < mon_y)
     {
-        return;
+        client->y = mon_y;
     }
 
-    if (NULL == focuswin->monitor)
+    if (client->x + client->width > mon_x + mon_width - conf.borderwidth * 2)
     {
-        mon_x = 0;
-        mon_y = 0;
-        mon_height = screen->height_in_pixels;
+        client->x = (mon_x + mon_width - conf.borderwidth * 2) - client->width;
     }
-    else
+
+    if (client->y + client->height > mon_y + mon_height - conf.borderwidth * 2)
     {
-        mon_x = focuswin->monitor->x;
-        mon_y = focuswin->monitor->y;
-        mon_height = focuswin->monitor->height;
+        client->y = (mon_y + mon_height - conf.borderwidth * 2)
+            - client->height;
     }
 
-    raisewindow(focuswin->id);
-
-    if (!getpointer(focuswin->id, &pointx, &pointy))
+    if (outlining(client))
     {
         return;
     }
 
-    focuswin->x = mon_x;
-    focuswin->y = mon_y + mon_height - (focuswin->height + conf.borderwidth
-                                        * 2);
-    movewindow(focuswin->id, focuswin->x, focuswin->y);
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     pointx, pointy);
-    xcb_flush(conn);
+    movewindow(client->id, client->x, client->y);
 }
 
-void botright(void)
+/* Move window win to root coordinates x,y. */
+void movewindow(xcb_drawable_t win, uint16_t x, uint16_t y)
 {
-    int16_t pointx;
-    int16_t pointy;
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
+    uint32_t values[2];
+    struct client *client;
 
-    if (NULL == focuswin)
+    if (screen->root == win || 0 == win)
     {
+        /* Can't move root. */
         return;
     }
 
-    if (NULL == focuswin->monitor)
-    {
-        mon_x = 0;
-        mon_y = 0;
-        mon_width = screen->width_in_pixels;;
-        mon_height = screen->height_in_pixels;
-    }
-    else
-    {
-        mon_x = focuswin->monitor->x;
-        mon_y = focuswin->monitor->y;
-        mon_width = focuswin->monitor->width;
-        mon_height = focuswin->monitor->height;
-    }
-
-    raisewindow(focuswin->id);
-
-    if (!getpointer(focuswin->id, &pointx, &pointy))
+    if (NULL != (client = findclient(win)))
     {
+        client->x = x;
+        client->y = y;
+        stagegeom(client, XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y);
         return;
     }
 
-    focuswin->x = mon_x + mon_width - (focuswin->width + conf.borderwidth * 2);
-    focuswin->y =  mon_y + mon_height - (focuswin->height + conf.borderwidth
-                                         * 2);
-    movewindow(focuswin->id, focuswin->x, focuswin->y);
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     pointx, pointy);
-    xcb_flush(conn);
+    values[0] = x;
+    values[1] = y;
+
+    configurewin(win, XCB_CONFIG_WINDOW_X
+                 | XCB_CONFIG_WINDOW_Y, values);
 }
 
-void deletewin(void)
+/* Change focus to next in window ring. */
+void focusnext(bool reverse)
 {
-    xcb_get_property_cookie_t cookie;
-    xcb_icccm_get_wm_protocols_reply_t protocols;
-    bool use_delete = false;
-    uint32_t i;
+    struct client *client = NULL;
 
-    if (NULL == focuswin)
+#if DEBUG
+    if (NULL != focuswin)
     {
-        return;
+        PDEBUG("Focus now in win %d\n", focuswin->id);
     }
+#endif
 
-    /* Check if WM_DELETE is supported.  */
-    cookie = xcb_icccm_get_wm_protocols_unchecked(conn, focuswin->id,
-                                                  wm_protocols);
-    if (xcb_icccm_get_wm_protocols_reply(conn, cookie, &protocols, NULL) == 1)
+    if (NULL == wslist[curws])
     {
-        for (i = 0; i < protocols.atoms_len; i++)
-        {
-            if (protocols.atoms[i] == wm_delete_window)
-            {
-                 use_delete = true;
-            }
-        }
+        PDEBUG("No windows to focus on in this workspace.\n");
+        return;
     }
 
-    xcb_icccm_get_wm_protocols_reply_wipe(&protocols);
+    if (MCWM_TABBING != mode)
+    {
+        /*
+         * Remember what we last focused on. We need this when the
+         * MODKEY is released and we move the last focused window in
+         * the tabbing order list.
+         */
+        lastfocuswin = focuswin;
+        mode = MCWM_TABBING;
+
+        PDEBUG("Began tabbing.\n");
+    }
 
-    if (use_delete)
+    /* If we currently have no focus focus first in list. */
+    if (NULL == focuswin || NULL == focuswin->wsitem[curws])
     {
-        xcb_client_message_event_t ev = {
-          .response_type = XCB_CLIENT_MESSAGE,
-          .format = 32,
-          .sequence = 0,
-          .window = focuswin->id,
-          .type = wm_protocols,
-          .data.data32 = { wm_delete_window, XCB_CURRENT_TIME }
-        };
+        PDEBUG("Focusing first in list: %p\n", wslist[curws]);
+        client = wslist[curws]->data;
 
-        xcb_send_event(conn, false, focuswin->id,
-                       XCB_EVENT_MASK_NO_EVENT, (char *) &ev);
+        if (NULL != focuswin && NULL == focuswin->wsitem[curws])
+        {
+            PDEBUG("XXX Our focused window %d isn't on this workspace!\n",
+                   focuswin->id);
+        }
     }
     else
     {
-        xcb_kill_client(conn, focuswin->id);
+        if (reverse)
+        {
+            if (NULL == focuswin->wsitem[curws]->prev)
+            {
+                /*
+                 * We were at the head of list. Focusing on last
+                 * window in list unless we were already there.
+                 */
+                struct item *last = wslist[curws];
+                while (NULL != last->next)
+                    last = last->next;
+                if (focuswin->wsitem[curws] != last->data)
+                {
+                    PDEBUG("Beginning of list. Focusing last in list: %p\n",
+                           last);
+                    client = last->data;
+                }
+            }
+            else
+            {
+                /* Otherwise, focus the next in list. */
+                PDEBUG("Tabbing. Focusing next: %p.\n",
+                       focuswin->wsitem[curws]->prev);
+                client = focuswin->wsitem[curws]->prev->data;
+            }
+        }
+        else
+        {
+            if (NULL == focuswin->wsitem[curws]->next)
+            {
+                /*
+                 * We were at the end of list. Focusing on first window in
+                 * list unless we were already there.
+                 */
+                if (focuswin->wsitem[curws] != wslist[curws]->data)
+                {
+                    PDEBUG("End of list. Focusing first in list: %p\n",
+                           wslist[curws]);
+                    client = wslist[curws]->data;
+                }
+            }
+            else
+            {
+                /* Otherwise, focus the next in list. */
+                PDEBUG("Tabbing. Focusing next: %p.\n",
+                       focuswin->wsitem[curws]->next);
+                client = focuswin->wsitem[curws]->next->data;
+            }
+        }
     }
 
-    xcb_flush(conn);
+    if (NULL != client)
+    {
+        /*
+         * Raise window if it's occluded, then warp pointer into it and
+         * set keyboard focus to it.
+         */
+        stagestack(client, XCB_STACK_MODE_TOP_IF, XCB_NONE);
+        warppointer(client->id, client->width / 2, client->height / 2);
+        setfocus(client);
+    }
 }
 
-void prevscreen(void)
+/* Mark window client as unfocused. */
+void setunfocus(struct client *client)
 {
-    struct item *item;
-
-    if (NULL == focuswin || NULL == focuswin->monitor)
+    if (NULL == focuswin)
     {
         return;
     }
 
-    item = focuswin->monitor->item->prev;
-
-    if (NULL == item)
+    if (focuswin->id == screen->root)
     {
         return;
     }
 
-    focuswin->monitor = item->data;
-
-    raisewindow(focuswin->id);
-    fitonscreen(focuswin);
-    movelim(focuswin);
-
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     0, 0);
-    xcb_flush(conn);
+    /* Set new border colour. */
+    setborderpixel(client, conf.unfocuscol);
 }
 
-void nextscreen(void)
+/*
+ * Set the border colour of client to pixel, unless it has that
+ * colour already.
+ */
+void setborderpixel(struct client *client, uint32_t pixel)
 {
-    struct item *item;
-
-    if (NULL == focuswin || NULL == focuswin->monitor)
-    {
-        return;
-    }
-
-    item = focuswin->monitor->item->next;
+    uint32_t values[1];
 
-    if (NULL == item)
+    if (client->haspixel && pixel == client->borderpixel)
     {
+        stats.borderskipped ++;
         return;
     }
 
-    focuswin->monitor = item->data;
-
-    raisewindow(focuswin->id);
-    fitonscreen(focuswin);
-    movelim(focuswin);
+    values[0] = pixel;
+    xcb_change_window_attributes(conn, client->id, XCB_CW_BORDER_PIXEL,
+                                 values);
 
-    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                     0, 0);
-    xcb_flush(conn);
+    client->haspixel = true;
+    client->borderpixel = pixel;
 }
 
-void handle_keypress(xcb_key_press_event_t *ev)
+/*
+ * Find client with client->id win in global window list.
+ *
+ * Returns client pointer or NULL if not found.
+ */
+struct client *findclient(xcb_drawable_t win)
 {
-    int i;
-    key_enum_t key;
+    struct item *item;
+    struct client *client;
 
-    for (key = KEY_MAX, i = KEY_F; i < KEY_MAX; i ++)
+    for (item = winlist; item != NULL; item = item->next)
     {
-        if (ev->detail == keys[i].keycode && 0 != keys[i].keycode)
+        client = item->data;
+        if (win == client->id)
         {
-            key = i;
+            PDEBUG("findclient: Found it. Win: %d\n", client->id);
+            return client;
+        }
+    }
+
+    return NULL;
+}
+
+/* Set focus on window client. */
+void setfocus(struct client *client)
+{
+
+    /*
+     * If client is NULL, we focus on whatever the pointer is on.
+     *
+     * This is a pathological case, but it will make the poor user
+     * able to focus on windows anyway, even though this window
+     * manager might be buggy.
+     */
+    if (NULL == client)
+    {
+        PDEBUG("setfocus: client was NULL!\n");
+
+        focuswin = NULL;
+
+        xcb_set_input_focus(conn, XCB_NONE, XCB_INPUT_FOCUS_POINTER_ROOT,
+                            XCB_CURRENT_TIME);
+
+        return;
+    }
+
+    /*
+     * Don't bother focusing on the root window or on the same window
+     * that already has focus.
+     */
+    if (client->id == screen->root || client == focuswin)
+    {
+        return;
+    }
+
+    /* Set new border colour. */
+    setborderpixel(client, client->fixed ? conf.fixedcol : conf.focuscol);
+
+    /* Unset last focus. */
+    if (NULL != focuswin)
+    {
+        setunfocus(focuswin);
+    }
+
+    /* Set new input focus. */
+
+    xcb_set_input_focus(conn, XCB_INPUT_FOCUS_POINTER_ROOT, client->id,
+                        XCB_CURRENT_TIME);
+
+    /* Remember the new window as the current focused window. */
+    focuswin = client;
+}
+
+int start(char *program)
+{
+    pid_t pid;
+
+    pid = fork();
+    if (-1 == pid)
+    {
+        perror("fork");
+        return -1;
+    }
+    else if (0 == pid)
+    {
+        char *argv[2];
+
+        /* In the child. */
+
+        /* Let the program get the signals we keep for ourselves. */
+        loopchild();
+
+        /*
+         * Make this process a new process leader, otherwise the
+         * terminal will die when the wm dies. Also, this makes any
+         * SIGCHLD go to this process when we fork again.
+         */
+        if (-1 == setsid())
+        {
+            perror("setsid");
+            exit(1);
+        }
+
+        argv[0] = program;
+        argv[1] = NULL;
+
+        if (-1 == execvp(program, argv))
+        {
+            perror("execve");
+            exit(1);
+        }
+        exit(0);
+    }
+
+    return 0;
+}
+
+/* Resize with limit. */
+void resizelim(struct client *client)
+{
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_width;
+    uint16_t mon_height;
+
+    if (NULL == client->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+        mon_width = screen->width_in_pixels;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_x = client->monitor->x;
+        mon_y = client->monitor->y;
+        mon_width = client->monitor->width;
+        mon_height = client->monitor->height;
+    }
+
+    /* Is it smaller than it wants to  be? */
+    if (0 != client->min_height && client->height < client->min_height)
+    {
+        client->height = client->min_height;
+    }
+
+    if (0 != client->min_width && client->width < client->min_width)
+    {
+        client->width = client->min_width;
+    }
+
+    if (client->x + client->width + conf.borderwidth * 2 > mon_x + mon_width)
+    {
+        client->width = mon_width - ((client->x - mon_x) + conf.borderwidth
+                                     * 2);
+    }
+
+    if (client->y + client->height + conf.borderwidth * 2 > mon_y + mon_height)
+    {
+        client->height = mon_height - ((client->y - mon_y) + conf.borderwidth
+                                       * 2);
+    }
+
+    if (outlining(client))
+    {
+        return;
+    }
+
+    resize(client->id, client->width, client->height);
+}
+
+void moveresize(xcb_drawable_t win, uint16_t x, uint16_t y,
+                uint16_t width, uint16_t height)
+{
+    uint32_t values[4];
+    struct client *client;
+
+    if (screen->root == win || 0 == win)
+    {
+        /* Can't move or resize root. */
+        return;
+    }
+
+    if (NULL != (client = findclient(win)))
+    {
+        client->x = x;
+        client->y = y;
+        client->width = width;
+        client->height = height;
+        stagegeom(client, XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
+                  | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT);
+        return;
+    }
+
+    PDEBUG("Moving to %d, %d, resizing to %d x %d.\n", x, y, width, height);
+
+    values[0] = x;
+    values[1] = y;
+    values[2] = width;
+    values[3] = height;
+
+    configurewin(win,
+                 XCB_CONFIG_WINDOW_X
+                 | XCB_CONFIG_WINDOW_Y
+                 | XCB_CONFIG_WINDOW_WIDTH
+                 | XCB_CONFIG_WINDOW_HEIGHT, values);
+}
+
+/* Resize window win to width,height. */
+void resize(xcb_drawable_t win, uint16_t width, uint16_t height)
+{
+    uint32_t values[2];
+    struct client *client;
+
+    if (screen->root == win || 0 == win)
+    {
+        /* Can't resize root. */
+        return;
+    }
+
+    PDEBUG("Resizing to %d x %d.\n", width, height);
+
+    if (NULL != (client = findclient(win)))
+    {
+        client->width = width;
+        client->height = height;
+        stagegeom(client, XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT);
+        return;
+    }
+
+    values[0] = width;
+    values[1] = height;
+
+    configurewin(win,
+                 XCB_CONFIG_WINDOW_WIDTH
+                 | XCB_CONFIG_WINDOW_HEIGHT, values);
+}
+
+/*
+ * Resize window client in direction direction. Direction is:
+ *
+ * h = left, that is decrease width.
+ *
+ * j = down, that is, increase height.
+ *
+ * k = up, that is, decrease height.
+ *
+ * l = right, that is, increase width.
+ *
+ * Resize steps steps at once.
+ */
+void resizestep(struct client *client, char direction, int steps)
+{
+    int step_x = MOVE_STEP;
+    int step_y = MOVE_STEP;
+
+    if (NULL == client)
+    {
+        return;
+    }
+
+    if (client->maxed)
+    {
+        /* Can't resize a fully maximized window. */
+        return;
+    }
+
+    if (syncwaiting(client))
+    {
+        /*
+         * It hasn't caught up with the last step yet. Do this one
+         * when it has.
+         */
+        switch (direction)
+        {
+        case 'h':
+            client->sync.held[0] += steps;
+            break;
+
+        case 'j':
+            client->sync.held[1] += steps;
             break;
+
+        case 'k':
+            client->sync.held[2] += steps;
+            break;
+
+        case 'l':
+            client->sync.held[3] += steps;
+            break;
+        }
+
+        stats.syncheld ++;
+        return;
+    }
+
+    raisewindow(client->id);
+
+    if (client->width_inc > 1)
+    {
+        step_x = client->width_inc;
+    }
+    else
+    {
+        step_x = MOVE_STEP;
+    }
+
+    if (client->height_inc > 1)
+    {
+        step_y = client->height_inc;
+    }
+    else
+    {
+        step_y = MOVE_STEP;
+    }
+
+    switch (direction)
+    {
+    case 'h':
+        if (client->width > step_x * steps)
+        {
+            client->width = client->width - step_x * steps;
+        }
+        break;
+
+    case 'j':
+        client->height = client->height + step_y * steps;
+        break;
+
+    case 'k':
+        if (client->height > step_y * steps)
+        {
+            client->height = client->height - step_y * steps;
+        }
+        break;
+
+    case 'l':
+        client->width = client->width + step_x * steps;
+        break;
+
+    default:
+        PDEBUG("resizestep in unknown direction.\n");
+        break;
+    } /* switch direction */
+
+    client->stage.sync = true;
+    resizelim(client);
+
+    /* If this window was vertically maximized, remember that it isn't now. */
+    if (client->vertmaxed)
+    {
+        client->vertmaxed = false;
+    }
+
+    warppointer(client->id, client->width / 2, client->height / 2);
+}
+
+/*
+ * Try to snap to other windows and monitor border
+ */
+static void snapwindow(struct client *client, int snap_mode)
+{
+    struct item *item;
+    struct client *win;
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_width;
+    uint16_t mon_height;
+
+    if (NULL == client->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+        mon_width = screen->width_in_pixels;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_x = client->monitor->x;
+        mon_y = client->monitor->y;
+        mon_width = client->monitor->width;
+        mon_height = client->monitor->height;
+    }
+    /*
+     * Go through all windows on current workspace.
+     */
+    for (item = wslist[curws]; item != NULL; item = item->next)
+    {
+        win = item->data;
+
+        if (client == win)
+        {
+            continue;
+        }
+
+        if (snap_mode == MCWM_MOVE)
+        {
+            if (abs((win->x +win->width) - client->x) < conf.snapmargin)
+            {
+                if (client->y + client->height > win->y
+                    && client->y < win->y + win->height)
+                {
+                    client->x = (win->x + win->width) + (2 * conf.borderwidth);
+                }
+            }
+
+            if (abs((win->y +win->height) - client->y) < conf.snapmargin)
+            {
+                if (client->x + client->width >win->x
+                    && client->x < win->x + win->width)
+                {
+                    client->y = (win->y + win->height) + (2 * conf.borderwidth);
+                }
+            }
+
+            if (abs((client->x + client->width) - win->x) < conf.snapmargin)
+            {
+                if (client->y + client->height > win->y
+                    && client->y < win->y + win->height)
+                {
+                    client->x = (win->x - client->width)
+                        - (2 * conf.borderwidth);
+                }
+            }
+
+            if (abs((client->y + client->height) - win->y) < conf.snapmargin)
+            {
+                if (client->x + client->width >win->x
+                    && client->x < win->x + win->width)
+                {
+                    client->y = (win->y - client->height)
+                        - (2 * conf.borderwidth);
+                }
+            }
+
+        } /* mcwm_move */
+        else if (snap_mode == MCWM_RESIZE)
+        {
+            if (abs((client->x + client->width) - win->x) < conf.snapmargin)
+            {
+                if (client->y + client->height > win->y
+                    && client->y < win->y + win->height)
+                {
+                    client->width = (win->x - client->x)
+                        - (2 * conf.borderwidth);
+                }
+            }
+
+            if (abs((client->y + client->height) - win->y) < conf.snapmargin)
+            {
+                if (client->x + client->width >win->x
+                    && client->x < win->x + win->width)
+                {
+                    client->height = (win->y - client->y)
+                        - (2 * conf.borderwidth);
+                }
+            }
+        } /* mcwm_resize */
+    }
+
+    /* monitor border */
+    if (snap_mode == MCWM_MOVE) {
+
+        if (abs(client->x - mon_x) < conf.snapmargin)
+        {
+            client->x = mon_x;
+        }
+
+        if (abs(client->y - mon_y) < conf.snapmargin)
+        {
+            client->y = mon_y;
+        }
+
+        if (abs((client->x + client->width) - mon_width) < conf.snapmargin)
+        {
+            client->x = (mon_width - client->width);
+        }
+
+        if (abs((client->y + client->height) - mon_height) < conf.snapmargin)
+        {
+            client->y = (mon_height - client->height);
+        }
+    }
+    else if (snap_mode == MCWM_RESIZE)
+    {
+        if (abs((client->width + client->x) - mon_width) < conf.snapmargin)
+        {
+            client->width = mon_width;
+        }
+        if (abs((client->height + client->y) - mon_height) < conf.snapmargin)
+        {
+            client->height = mon_height;
+        }
+    }
+}
+
+/*
+ * Move window win as a result of pointer motion to coordinates
+ * rel_x,rel_y.
+ */
+void mousemove(struct client *client, int rel_x, int rel_y)
+{
+    client->x = rel_x;
+    client->y = rel_y;
+
+    if (conf.snapmargin > 0)
+    {
+        snapwindow(client, MCWM_MOVE);
+    }
+
+    movelim(client);
+}
+
+void mouseresize(struct client *client, int rel_x, int rel_y)
+{
+
+    client->width = abs(rel_x - client->x);
+    client->height = abs(rel_y - client->y);
+
+    client->width -= (client->width - client->base_width) % client->width_inc;
+    client->height -= (client->height - client->base_height)
+        % client->height_inc;
+
+    PDEBUG("Trying to resize to %dx%d (%dx%d)\n", client->width, client->height,
+           (client->width - client->base_width) / client->width_inc,
+           (client->height - client->base_height) / client->height_inc);
+
+    if (conf.snapmargin > 0)
+    {
+        snapwindow(client, MCWM_RESIZE);
+    }
+
+    resizelim(client);
+
+    /* If this window was vertically maximized, remember that it isn't now. */
+    if (client->vertmaxed)
+    {
+        client->vertmaxed = false;
+    }
+}
+
+/* Move window client steps steps in direction direction. */
+void movestep(struct client *client, char direction, int steps)
+{
+    int16_t start_x;
+    int16_t start_y;
+
+    if (NULL == client)
+    {
+        return;
+    }
+
+    if (client->maxed)
+    {
+        /* We can't move a fully maximized window. */
+        return;
+    }
+
+    /* Save pointer position so we can warp pointer here later. */
+    if (!getpointer(client, &start_x, &start_y))
+    {
+        return;
+    }
+
+    raisewindow(client->id);
+    switch (direction)
+    {
+    case 'h':
+        client->x = client->x - MOVE_STEP * steps;
+        break;
+
+    case 'j':
+        client->y = client->y + MOVE_STEP * steps;
+        break;
+
+    case 'k':
+        client->y = client->y - MOVE_STEP * steps;
+        break;
+
+    case 'l':
+        client->x = client->x + MOVE_STEP * steps;
+        break;
+
+    default:
+        PDEBUG("movestep: Moving in unknown direction.\n");
+        break;
+    } /* switch direction */
+
+    movelim(client);
+
+    /*
+     * If the pointer was inside the window to begin with, move
+     * pointer back to where it was, relative to the window.
+     */
+    if (start_x > 0 - conf.borderwidth && start_x < client->width
+        + conf.borderwidth && start_y > 0 - conf.borderwidth && start_y
+        < client->height + conf.borderwidth)
+    {
+        warppointer(client->id, start_x, start_y);
+    }
+}
+
+void setborders(struct client *client, int width)
+{
+    stageborder(client, width);
+}
+
+void unmax(struct client *client)
+{
+    if (NULL == client)
+    {
+        PDEBUG("unmax: client was NULL!\n");
+        return;
+    }
+
+    client->x = client->origsize.x;
+    client->y = client->origsize.y;
+    client->width = client->origsize.width;
+    client->height = client->origsize.height;
+
+    /* Restore geometry. */
+    if (client->maxed)
+    {
+        /* Set borders again. */
+        stageborder(client, conf.borderwidth);
+
+        stagegeom(client, XCB_CONFIG_WINDOW_X
+                  | XCB_CONFIG_WINDOW_Y
+                  | XCB_CONFIG_WINDOW_WIDTH
+                  | XCB_CONFIG_WINDOW_HEIGHT);
+    }
+    else
+    {
+        stagegeom(client, XCB_CONFIG_WINDOW_Y
+                  | XCB_CONFIG_WINDOW_WIDTH
+                  | XCB_CONFIG_WINDOW_HEIGHT);
+    }
+
+    /* Warp pointer to window or we might lose it. */
+    warppointer(client->id, client->width / 2, client->height / 2);
+}
+
+void maximize(struct client *client)
+{
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_width;
+    uint16_t mon_height;
+
+    if (NULL == client)
+    {
+        PDEBUG("maximize: client was NULL!\n");
+        return;
+    }
+
+    if (NULL == client->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+        mon_width = screen->width_in_pixels;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_x = client->monitor->x;
+        mon_y = client->monitor->y;
+        mon_width = client->monitor->width;
+        mon_height = client->monitor->height;
+    }
+
+    /*
+     * Check if maximized already. If so, revert to stored
+     * geometry.
+     */
+    if (client->maxed)
+    {
+        unmax(client);
+        client->maxed = false;
+        return;
+    }
+
+    /* Raise first. Pretty silly to maximize below something else. */
+    raisewindow(client->id);
+
+    /* FIXME: Store original geom in property as well? */
+    client->origsize.x = client->x;
+    client->origsize.y = client->y;
+    client->origsize.width = client->width;
+    client->origsize.height = client->height;
+
+    /* Remove borders. */
+    stageborder(client, 0);
+
+    /* Move to top left and resize. */
+    client->x = mon_x;
+    client->y = mon_y;
+    client->width = mon_width;
+    client->height = mon_height;
+
+    stagegeom(client, XCB_CONFIG_WINDOW_X
+              | XCB_CONFIG_WINDOW_Y
+              | XCB_CONFIG_WINDOW_WIDTH
+              | XCB_CONFIG_WINDOW_HEIGHT);
+
+    client->maxed = true;
+}
+
+void maxvert(struct client *client)
+{
+    int16_t mon_y;
+    uint16_t mon_height;
+
+    if (NULL == client)
+    {
+        PDEBUG("maxvert: client was NULL\n");
+        return;
+    }
+
+    if (NULL == client->monitor)
+    {
+        mon_y = 0;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_y = client->monitor->y;
+        mon_height = client->monitor->height;
+    }
+
+    /*
+     * Check if maximized already. If so, revert to stored geometry.
+     */
+    if (client->vertmaxed)
+    {
+        unmax(client);
+        client->vertmaxed = false;
+        return;
+    }
+
+    /* Raise first. Pretty silly to maximize below something else. */
+    raisewindow(client->id);
+
+    /*
+     * Store original coordinates and geometry.
+     * FIXME: Store in property as well?
+     */
+    client->origsize.x = client->x;
+    client->origsize.y = client->y;
+    client->origsize.width = client->width;
+    client->origsize.height = client->height;
+
+    client->y = mon_y;
+    /* Compute new height considering height increments and screen height. */
+    client->height = mon_height - conf.borderwidth * 2;
+    client->height -= (client->height - client->base_height)
+        % client->height_inc;
+
+    /* Move to top of screen and resize. */
+    stagegeom(client, XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_HEIGHT);
+
+    /* Remember that this client is vertically maximized. */
+    client->vertmaxed = true;
+}
+
+void hide(struct client *client)
+{
+    long data[] = { XCB_ICCCM_WM_STATE_ICONIC, XCB_NONE };
+
+    /*
+     * Unmap window and declare iconic.
+     *
+     * Unmapping will generate an UnmapNotify event so we can forget
+     * about the window later.
+     */
+    xcb_unmap_window(conn, client->id);
+    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, client->id,
+                        wm_state, wm_state, 32, 2, data);
+}
+
+/*
+ * Find out where the pointer is relative to the inside of client's
+ * window. Asks the server unless the event we're handling told us.
+ *
+ * Returns true on success.
+ */
+bool getpointer(const struct client *client, int16_t *x, int16_t *y)
+{
+    xcb_query_pointer_cookie_t cookie;
+    xcb_query_pointer_reply_t *pointer;
+    int16_t border;
+
+    if (pointerfresh())
+    {
+        border = client->borderwidth;
+
+        *x = pointerpos.x - client->x - border;
+        *y = pointerpos.y - client->y - border;
+
+        stats.pointerhits ++;
+        return true;
+    }
+
+    cookie = xcb_query_pointer(conn, client->id);
+    pointer = xcb_query_pointer_reply(conn, cookie, 0);
+    if (NULL == pointer)
+    {
+        return false;
+    }
+
+    stats.pointerqueries ++;
+
+    *x = pointer->win_x;
+    *y = pointer->win_y;
+
+    /* We waited for it, so nothing we sent earlier can be newer. */
+    setpointer(pointer->root_x, pointer->root_y, cookie.sequence);
+
+    free(pointer);
+
+    return true;
+}
+
+/*
+ * Remember where the pointer was when the server handled request
+ * number sequence.
+ */
+void setpointer(int16_t x, int16_t y, unsigned int sequence)
+{
+    pointerpos.known = true;
+    pointerpos.current = true;
+    pointerpos.x = x;
+    pointerpos.y = y;
+    pointerpos.sequence = sequence;
+}
+
+/*
+ * Do we know where the pointer is without asking? Only if the event
+ * we're handling told us, or we put it there or asked for it since.
+ * Between events it can move over client windows without us hearing
+ * about it.
+ */
+bool pointerfresh(void)
+{
+    return pointerpos.known && pointerpos.current;
+}
+
+/*
+ * Update our idea of where the pointer is from any event that
+ * carries root coordinates. Events generated before our last warp
+ * don't count. Any other event makes what we know out of date.
+ */
+void trackpointer(xcb_generic_event_t *ev)
+{
+    int16_t x;
+    int16_t y;
+
+    pointerpos.current = false;
+
+    switch (ev->response_type & ~0x80)
+    {
+    case XCB_KEY_PRESS:
+    case XCB_KEY_RELEASE:
+    {
+        xcb_key_press_event_t *e = (xcb_key_press_event_t *) ev;
+
+        if (!e->same_screen)
+        {
+            return;
+        }
+        x = e->root_x;
+        y = e->root_y;
+    }
+    break;
+
+    case XCB_BUTTON_PRESS:
+    case XCB_BUTTON_RELEASE:
+    {
+        xcb_button_press_event_t *e = (xcb_button_press_event_t *) ev;
+
+        if (!e->same_screen)
+        {
+            return;
+        }
+        x = e->root_x;
+        y = e->root_y;
+    }
+    break;
+
+    case XCB_MOTION_NOTIFY:
+    {
+        xcb_motion_notify_event_t *e = (xcb_motion_notify_event_t *) ev;
+
+        if (!e->same_screen)
+        {
+            return;
+        }
+        x = e->root_x;
+        y = e->root_y;
+    }
+    break;
+
+    case XCB_ENTER_NOTIFY:
+    case XCB_LEAVE_NOTIFY:
+    {
+        xcb_enter_notify_event_t *e = (xcb_enter_notify_event_t *) ev;
+
+        /* Bit 1 is same-screen. */
+        if (!(e->same_screen_focus & 2))
+        {
+            return;
+        }
+        x = e->root_x;
+        y = e->root_y;
+    }
+    break;
+
+    default:
+        return;
+    }
+
+    if ((int32_t) (ev->full_sequence - pointerpos.sequence) < 0)
+    {
+        return;
+    }
+
+    pointerpos.known = true;
+    pointerpos.current = true;
+    pointerpos.x = x;
+    pointerpos.y = y;
+}
+
+void topleft(void)
+{
+    int16_t pointx;
+    int16_t pointy;
+    int16_t mon_x;
+    int16_t mon_y;
+
+    if (NULL == focuswin)
+    {
+        return;
+    }
+
+    if (NULL == focuswin->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+    }
+    else
+    {
+        mon_x = focuswin->monitor->x;
+        mon_y = focuswin->monitor->y;
+    }
+
+    raisewindow(focuswin->id);
+
+    if (!getpointer(focuswin, &pointx, &pointy))
+    {
+        return;
+    }
+
+    focuswin->x = mon_x;
+    focuswin->y = mon_y;
+    movewindow(focuswin->id, focuswin->x, focuswin->y);
+    warppointer(focuswin->id, pointx, pointy);
+}
+
+void topright(void)
+{
+    int16_t pointx;
+    int16_t pointy;
+    int16_t mon_x;
+    uint16_t mon_y;
+    uint16_t mon_width;
+
+    if (NULL == focuswin)
+    {
+        return;
+    }
+
+    if (NULL == focuswin->monitor)
+    {
+        mon_width = screen->width_in_pixels;
+        mon_x = 0;
+        mon_y = 0;
+    }
+    else
+    {
+        mon_width = focuswin->monitor->width;
+        mon_x = focuswin->monitor->x;
+        mon_y = focuswin->monitor->y;
+    }
+
+    raisewindow(focuswin->id);
+
+    if (!getpointer(focuswin, &pointx, &pointy))
+    {
+        return;
+    }
+
+    focuswin->x = mon_x + mon_width -
+        (focuswin->width + conf.borderwidth * 2);
+
+    focuswin->y = mon_y;
+
+    movewindow(focuswin->id, focuswin->x, focuswin->y);
+
+    warppointer(focuswin->id, pointx, pointy);
+}
+
+void botleft(void)
+{
+    int16_t pointx;
+    int16_t pointy;
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_height;
+
+    if (NULL == focuswin)
+    {
+        return;
+    }
+
+    if (NULL == focuswin->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_x = focuswin->monitor->x;
+        mon_y = focuswin->monitor->y;
+        mon_height = focuswin->monitor->height;
+    }
+
+    raisewindow(focuswin->id);
+
+    if (!getpointer(focuswin, &pointx, &pointy))
+    {
+        return;
+    }
+
+    focuswin->x = mon_x;
+    focuswin->y = mon_y + mon_height - (focuswin->height + conf.borderwidth
+                                        * 2);
+    movewindow(focuswin->id, focuswin->x, focuswin->y);
+    warppointer(focuswin->id, pointx, pointy);
+}
+
+void botright(void)
+{
+    int16_t pointx;
+    int16_t pointy;
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_width;
+    uint16_t mon_height;
+
+    if (NULL == focuswin)
+    {
+        return;
+    }
+
+    if (NULL == focuswin->monitor)
+    {
+        mon_x = 0;
+        mon_y = 0;
+        mon_width = screen->width_in_pixels;;
+        mon_height = screen->height_in_pixels;
+    }
+    else
+    {
+        mon_x = focuswin->monitor->x;
+        mon_y = focuswin->monitor->y;
+        mon_width = focuswin->monitor->width;
+        mon_height = focuswin->monitor->height;
+    }
+
+    raisewindow(focuswin->id);
+
+    if (!getpointer(focuswin, &pointx, &pointy))
+    {
+        return;
+    }
+
+    focuswin->x = mon_x + mon_width - (focuswin->width + conf.borderwidth * 2);
+    focuswin->y =  mon_y + mon_height - (focuswin->height + conf.borderwidth
+                                         * 2);
+    movewindow(focuswin->id, focuswin->x, focuswin->y);
+    warppointer(focuswin->id, pointx, pointy);
+}
+
+/*
+ * Ask the focused window to close. Send it WM_DELETE_WINDOW if it
+ * supports it, otherwise kill it. We know what protocols it supports
+ * from the property cache.
+ */
+void deletewin(void)
+{
+    if (NULL == focuswin)
+    {
+        return;
+    }
+
+    if (focuswin->props.deletewindow)
+    {
+        xcb_client_message_event_t ev = {
+          .response_type = XCB_CLIENT_MESSAGE,
+          .format = 32,
+          .sequence = 0,
+          .window = focuswin->id,
+          .type = wm_protocols,
+          .data.data32 = { wm_delete_window, XCB_CURRENT_TIME }
+        };
+
+        xcb_send_event(conn, false, focuswin->id,
+                       XCB_EVENT_MASK_NO_EVENT, (char *) &ev);
+    }
+    else
+    {
+        xcb_kill_client(conn, focuswin->id);
+    }
+}
+
+void prevscreen(void)
+{
+    struct item *item;
+
+    if (NULL == focuswin || NULL == focuswin->monitor)
+    {
+        return;
+    }
+
+    item = focuswin->monitor->item->prev;
+
+    if (NULL == item)
+    {
+        return;
+    }
+
+    focuswin->monitor = item->data;
+
+    raisewindow(focuswin->id);
+    fitonscreen(focuswin);
+    movelim(focuswin);
+
+    warppointer(focuswin->id, 0, 0);
+}
+
+void nextscreen(void)
+{
+    struct item *item;
+
+    if (NULL == focuswin || NULL == focuswin->monitor)
+    {
+        return;
+    }
+
+    item = focuswin->monitor->item->next;
+
+    if (NULL == item)
+    {
+        return;
+    }
+
+    focuswin->monitor = item->data;
+
+    raisewindow(focuswin->id);
+    fitonscreen(focuswin);
+    movelim(focuswin);
+
+    warppointer(focuswin->id, 0, 0);
+}
+
+void handle_keypress(xcb_generic_event_t *event)
+{
+    xcb_key_press_event_t *ev = (xcb_key_press_event_t *) event;
+    int i;
+    key_enum_t key;
+    int steps = 1 + keyrepeats;   /* Autorepeats merged into this one. */
+
+    PDEBUG("Key %d pressed\n", ev->detail);
+
+    for (key = KEY_MAX, i = KEY_F; i < KEY_MAX; i ++)
+    {
+        if (ev->detail == keys[i].keycode && 0 != keys[i].keycode)
+        {
+            key = i;
+            break;
+        }
+    }
+    if (key == KEY_MAX)
+    {
+        PDEBUG("Unknown key pressed.\n");
+
+        /*
+         * We don't know what to do with this key. Send this key press
+         * event to the focused window.
+         */
+        xcb_send_event(conn, false, XCB_SEND_EVENT_DEST_ITEM_FOCUS,
+                       XCB_EVENT_MASK_NO_EVENT, (char *) ev);
+        return;
+    }
+
+    if (MCWM_TABBING == mode && key != KEY_TAB && key != KEY_BACKTAB)
+    {
+        /* First finish tabbing around. Then deal with the next key. */
+        finishtabbing();
+    }
+
+    /* Is it shifted? */
+    if (ev->state & SHIFTMOD)
+    {
+        switch (key)
+        {
+        case KEY_H: /* h */
+            resizestep(focuswin, 'h', steps);
+            break;
+
+        case KEY_J: /* j */
+            resizestep(focuswin, 'j', steps);
+            break;
+
+        case KEY_K: /* k */
+            resizestep(focuswin, 'k', steps);
+            break;
+
+        case KEY_L: /* l */
+            resizestep(focuswin, 'l', steps);
+            break;
+
+        case KEY_TAB: /* shifted tab counts as backtab */
+            focusnext(true);
+            break;
+
+        default:
+            /* Ignore other shifted keys. */
+            break;
+        }
+    }
+    else
+    {
+        switch (key)
+        {
+        case KEY_RET: /* return */
+            start(conf.terminal);
+            break;
+
+        case KEY_F: /* f */
+            fixwindow(focuswin, true);
+            break;
+
+        case KEY_H: /* h */
+            movestep(focuswin, 'h', steps);
+            break;
+
+        case KEY_J: /* j */
+            movestep(focuswin, 'j', steps);
+            break;
+
+        case KEY_K: /* k */
+            movestep(focuswin, 'k', steps);
+            break;
+
+        case KEY_L: /* l */
+            movestep(focuswin, 'l', steps);
+            break;
+
+        case KEY_TAB: /* tab */
+            focusnext(false);
+            break;
+
+        case KEY_BACKTAB: /* backtab */
+            focusnext(true);
+            break;
+
+        case KEY_M: /* m */
+            maxvert(focuswin);
+            break;
+
+        case KEY_R: /* r*/
+            raiseorlower(focuswin);
+            break;
+
+        case KEY_X: /* x */
+            maximize(focuswin);
+            break;
+
+        case KEY_1:
+            changeworkspace(0);
+            break;
+
+        case KEY_2:
+            changeworkspace(1);
+            break;
+
+        case KEY_3:
+            changeworkspace(2);
+            break;
+
+        case KEY_4:
+            changeworkspace(3);
+            break;
+
+        case KEY_5:
+            changeworkspace(4);
+            break;
+
+        case KEY_6:
+            changeworkspace(5);
+            break;
+
+        case KEY_7:
+            changeworkspace(6);
+            break;
+
+        case KEY_8:
+            changeworkspace(7);
+            break;
+
+        case KEY_9:
+            changeworkspace(8);
+            break;
+
+        case KEY_0:
+            changeworkspace(9);
+            break;
+
+        case KEY_Y:
+            topleft();
+            break;
+
+        case KEY_U:
+            topright();
+            break;
+
+        case KEY_B:
+            botleft();
+            break;
+
+        case KEY_N:
+            botright();
+            break;
+
+        case KEY_END:
+            deletewin();
+            break;
+
+        case KEY_PREVSCR:
+            prevscreen();
+            break;
+
+        case KEY_NEXTSCR:
+            nextscreen();
+            break;
+
+        case KEY_ICONIFY:
+            if (conf.allowicons)
+            {
+                hide(focuswin);
+            }
+            break;
+
+        case KEY_PREVWS:
+            if (curws > 0)
+            {
+                changeworkspace(curws - 1);
+            }
+            else
+            {
+                changeworkspace(WORKSPACES - 1);
+            }
+            break;
+
+        case KEY_NEXTWS:
+            changeworkspace((curws + 1) % WORKSPACES);
+            break;
+
+        default:
+            /* Ignore other keys. */
+            break;
+        } /* switch unshifted */
+    }
+} /* handle_keypress() */
+
+/* Helper function to configure a window. */
+void configwin(xcb_window_t win, uint16_t mask, struct winconf wc)
+{
+    uint32_t values[7];
+    int i = -1;
+
+    if (mask & XCB_CONFIG_WINDOW_X)
+    {
+        mask |= XCB_CONFIG_WINDOW_X;
+        i ++;
+        values[i] = wc.x;
+    }
+
+    if (mask & XCB_CONFIG_WINDOW_Y)
+    {
+        mask |= XCB_CONFIG_WINDOW_Y;
+        i ++;
+        values[i] = wc.y;
+    }
+
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)
+    {
+        mask |= XCB_CONFIG_WINDOW_WIDTH;
+        i ++;
+        values[i] = wc.width;
+    }
+
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+    {
+        mask |= XCB_CONFIG_WINDOW_HEIGHT;
+        i ++;
+        values[i] = wc.height;
+    }
+
+    if (mask & XCB_CONFIG_WINDOW_SIBLING)
+    {
+        mask |= XCB_CONFIG_WINDOW_SIBLING;
+        i ++;
+        values[i] = wc.sibling;
+    }
+
+    if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    {
+        mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+        i ++;
+        values[i] = wc.stackmode;
+    }
+
+    if (-1 != i)
+    {
+        configurewin(win, mask, values);
+    }
+}
+
+/*
+ * Count configure request e from client. If it's over the limit for
+ * this second, merge it with anything else we held back and act on
+ * it when the next second starts.
+ *
+ * Returns true if we held the request back.
+ */
+bool ratelimit(struct client *client, xcb_configure_request_event_t *e)
+{
+    uint64_t now;
+
+    client->flood.total ++;
+    stats.confrequests ++;
+
+    if (0 == conf.confrate)
+    {
+        return false;
+    }
+
+    now = loopnow();
+    if (now - client->flood.start >= 1000)
+    {
+        client->flood.start = now;
+        client->flood.count = 0;
+
+        /*
+         * The timer for what we held back hasn't fired yet. Don't let
+         * it apply the older request over this one later. Fold it in
+         * here instead.
+         */
+        if (client->flood.pending)
+        {
+            mergeconfreq(&client->flood.request, e);
+            client->flood.pending = false;
+        }
+
+        if (NULL != client->flood.timer)
+        {
+            deltimer(client->flood.timer);
+            client->flood.timer = NULL;
+        }
+    }
+
+    if (client->flood.count < conf.confrate)
+    {
+        client->flood.count ++;
+        return false;
+    }
+
+    /* Later values win over the ones we already held back. */
+    if (client->flood.pending)
+    {
+        mergeconfreq(&client->flood.request, e);
+    }
+    client->flood.request = *e;
+    client->flood.pending = true;
+
+    if (0 == client->flood.held)
+    {
+        PDEBUG("Window %d is flooding us with configure requests.\n",
+               client->id);
+        stats.flooders ++;
+    }
+    client->flood.held ++;
+    stats.confheld ++;
+
+    if (NULL == client->flood.timer)
+    {
+        client->flood.timer = addtimer(client->flood.start + 1000 - now,
+                                       floodtimeout,
+                                       (void *) (uintptr_t) client->id);
+    }
+
+    return true;
+}
+
+/* A new second for a flooding client. Act on what we held back. */
+void floodtimeout(void *data)
+{
+    struct client *client;
+    xcb_configure_request_event_t request;
+
+    if (NULL == (client = findclient((uintptr_t) data)))
+    {
+        return;
+    }
+
+    client->flood.timer = NULL;
+
+    if (!client->flood.pending)
+    {
+        return;
+    }
+
+    request = client->flood.request;
+    client->flood.pending = false;
+
+    /* It's counted again, so don't count it twice. */
+    client->flood.total --;
+    stats.confrequests --;
+
+    configurerequest(&request);
+}
+
+/* Forget any request we held back from client. */
+void freeflood(struct client *client)
+{
+    if (NULL != client->flood.timer)
+    {
+        deltimer(client->flood.timer);
+        client->flood.timer = NULL;
+    }
+
+    client->flood.pending = false;
+}
+
+void configurerequest(xcb_configure_request_event_t *e)
+{
+    struct client *client;
+    struct adopt *adopt;
+    struct winconf wc;
+    int16_t mon_x;
+    int16_t mon_y;
+    uint16_t mon_width;
+    uint16_t mon_height;
+
+    PDEBUG("event: Configure request. mask = %d\n", e->value_mask);
+
+    /* Find the client. */
+    if ((client = findclient(e->window)))
+    {
+        if (ratelimit(client, e))
+        {
+            return;
+        }
+
+        /* Find monitor position and size. */
+        if (NULL == client || NULL == client->monitor)
+        {
+            mon_x = 0;
+            mon_y = 0;
+            mon_width = screen->width_in_pixels;
+            mon_height = screen->height_in_pixels;
+        }
+        else
+        {
+            mon_x = client->monitor->x;
+            mon_y = client->monitor->y;
+            mon_width = client->monitor->width;
+            mon_height = client->monitor->height;
+        }
+
+#if 0
+        /*
+         * We ignore moves the user haven't initiated, that is do
+         * nothing on XCB_CONFIG_WINDOW_X and XCB_CONFIG_WINDOW_Y
+         * ConfigureRequests.
+         *
+         * Code here if we ever change our minds or if you, dear user,
+         * wants this functionality.
+         */
+
+        if (e->value_mask & XCB_CONFIG_WINDOW_X)
+        {
+            /* Don't move window if maximized. Don't move off the screen. */
+            if (!client->maxed && e->x > 0)
+            {
+                client->x = e->x;
+            }
+        }
+
+        if (e->value_mask & XCB_CONFIG_WINDOW_Y)
+        {
+            /*
+             * Don't move window if maximized. Don't move off the
+             * screen.
+             */
+            if (!client->maxed && !client->vertmaxed && e->y > 0)
+            {
+                client->y = e->y;
+            }
+        }
+#endif
+
+        if (e->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+        {
+            /* Don't resize if maximized. */
+            if (!client->maxed)
+            {
+                client->width = e->width;
+            }
+        }
+
+        if (e->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+        {
+            /* Don't resize if maximized. */
+            if (!client->maxed && !client->vertmaxed)
+            {
+                client->height = e->height;
+            }
+        }
+
+        /* Check if window fits on screen after resizing. */
+
+        if (client->x + client->width + 2 * conf.borderwidth
+            > mon_x + mon_width)
+        {
+            /*
+             * See if it fits if we move away the window from the
+             * right edge of the screen.
+             */
+            client->x = mon_x + mon_width
+                - (client->width + 2 * conf.borderwidth);
+
+            /*
+             * If we moved over the left screen edge, move back and
+             * fit exactly on screen.
+             */
+            if (client->x < mon_x)
+            {
+                client->x = mon_x;
+                client->width = mon_width - 2 * conf.borderwidth;
+            }
+        }
+
+        if (client->y + client->height + 2 * conf.borderwidth
+            > mon_y + mon_height)
+        {
+            /*
+             * See if it fits if we move away the window from the
+             * bottom edge.
+             */
+            client->y = mon_y + mon_height
+                - (client->height + 2 * conf.borderwidth);
+
+            /*
+             * If we moved over the top screen edge, move back and fit
+             * on screen.
+             */
+            if (client->y < mon_y)
+            {
+                PDEBUG("over the edge: y < %d\n", mon_y);
+                client->y = mon_y;
+                client->height = mon_height - 2 * conf.borderwidth;
+            }
+        }
+
+        /*
+         * The new geometry and any stacking change go out in one
+         * configure. A sibling only means something with a stack
+         * mode. The client gets to know even if nothing changes.
+         *
+         * XXX Do we really need to pass on sibling and stack mode
+         * configuration? Do we want to?
+         */
+        stagegeom(client, XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
+                  | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT);
+
+        if (e->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
+        {
+            stagestack(client, e->stack_mode,
+                       (e->value_mask & XCB_CONFIG_WINDOW_SIBLING)
+                       ? e->sibling : XCB_NONE);
+        }
+
+        client->stage.notify = true;
+    }
+    else
+    {
+        PDEBUG("We don't know about this window yet.\n");
+
+        /*
+         * Unmapped window. Just pass all options except border
+         * width.
+         */
+        wc.x = e->x;
+        wc.y = e->y;
+        wc.width = e->width;
+        wc.height = e->height;
+        wc.sibling = e->sibling;
+        wc.stackmode = e->stack_mode;
+
+        configwin(e->window, e->value_mask, wc);
+
+        /*
+         * We ignore the ConfigureNotify this generates, so keep track
+         * of the geometry ourselves if we'll manage the window.
+         */
+        if (NULL != (adopt = findadopt(e->window)))
+        {
+            if (e->value_mask & XCB_CONFIG_WINDOW_X)
+            {
+                adopt->geom.x = e->x;
+            }
+            if (e->value_mask & XCB_CONFIG_WINDOW_Y)
+            {
+                adopt->geom.y = e->y;
+            }
+            if (e->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+            {
+                adopt->geom.width = e->width;
+            }
+            if (e->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+            {
+                adopt->geom.height = e->height;
+            }
+        }
+    }
+}
+
+void handle_configurerequest(xcb_generic_event_t *ev)
+{
+    configurerequest((xcb_configure_request_event_t *) ev);
+}
+
+/*
+ * The pointer position we asked for after a motion hint arrived. Move
+ * or resize the focused window accordingly.
+ */
+void motionreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_query_pointer_reply_t *pointer = reply;
+
+    if (NULL == pointer)
+    {
+        PDEBUG("Couldn't get pointer position.\n");
+        return;
+    }
+
+    /*
+     * We might have stopped moving, or lost the window, while we were
+     * waiting.
+     */
+    if (NULL == focuswin || focuswin->maxed)
+    {
+        return;
+    }
+
+    drag.x = pointer->root_x;
+    drag.y = pointer->root_y;
+    drag.pending = true;
+
+    applydrag();
+}
+
+/* Does client's WM_CLASS say it wants to be moved as an outline? */
+bool outlineclass(const struct client *client)
+{
+    static const char *classes[] = OUTLINECLASSES;
+    int i;
+
+    if (NULL == client->props.wmclass)
+    {
+        return false;
+    }
+
+    for (i = 0; NULL != classes[i]; i ++)
+    {
+        if (0 == strcmp(classes[i], client->props.wmclass))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if we're dragging an outline of client around instead
+ * of the window itself. Its geometry is where the outline is and only
+ * reaches the server when we're done.
+ */
+bool outlining(const struct client *client)
+{
+    return drag.outline && client == focuswin
+        && (MCWM_MOVE == mode || MCWM_RESIZE == mode);
+}
+
+/*
+ * Set up the graphics context we draw outlines with. Drawing with XOR
+ * twice restores the root and everything on it.
+ */
+void setupoutline(void)
+{
+    uint32_t values[3];
+
+    outlinegc = xcb_generate_id(conn);
+
+    values[0] = XCB_GX_XOR;
+    values[1] = screen->white_pixel ^ screen->black_pixel;
+    values[2] = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
+
+    xcb_create_gc(conn, outlinegc, screen->root,
+                  XCB_GC_FUNCTION | XCB_GC_FOREGROUND
+                  | XCB_GC_SUBWINDOW_MODE, values);
+}
+
+/* Draw the outline of client, borders included. */
+void showoutline(const struct client *client)
+{
+    hideoutline();
+
+    drag.rect.x = client->x;
+    drag.rect.y = client->y;
+    drag.rect.width = client->width + conf.borderwidth * 2 - 1;
+    drag.rect.height = client->height + conf.borderwidth * 2 - 1;
+
+    xcb_poly_rectangle(conn, screen->root, outlinegc, 1, &drag.rect);
+    drag.shown = true;
+}
+
+/* Remove the outline, if any, by drawing it again. */
+void hideoutline(void)
+{
+    if (!drag.shown)
+    {
+        return;
+    }
+
+    xcb_poly_rectangle(conn, screen->root, outlinegc, 1, &drag.rect);
+    drag.shown = false;
+}
+
+/* Current monotonic time in microseconds. */
+uint64_t microseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * How long a frame lasts, in microseconds, on the monitor at x, y in
+ * root coordinates.
+ */
+uint64_t frameinterval(int16_t x, int16_t y)
+{
+    struct monitor *mon;
+    uint32_t refresh = DEFAULT_REFRESH;
+
+    mon = findmonbycoord(x, y);
+    if (NULL != mon && 0 != mon->refresh)
+    {
+        refresh = mon->refresh;
+    }
+
+    return 1000000000ULL / refresh;
+}
+
+/*
+ * Move or resize the window we're dragging to the latest position,
+ * but not more often than the monitor under the pointer refreshes.
+ * If the last frame was too recent, we do it from a timer when the
+ * next one is due. Whatever position is latest by then is the one we
+ * use.
+ */
+void applydrag(void)
+{
+    uint64_t now;
+    uint64_t next;
+
+    if (!drag.pending || NULL != drag.timer)
+    {
+        return;
+    }
+
+    /*
+     * Don't resize a client that hasn't caught up with the last size.
+     * We're called again when it has.
+     */
+    if (MCWM_RESIZE == mode && NULL != focuswin && syncwaiting(focuswin))
+    {
+        stats.syncheld ++;
+        return;
+    }
+
+    now = microseconds();
+    next = drag.last + frameinterval(drag.x, drag.y);
+    if (now < next)
+    {
+        /* Round up to whole milliseconds, the timers' resolution. */
+        drag.timer = addtimer((next - now + 999) / 1000, dragframe, NULL);
+        if (NULL != drag.timer)
+        {
+            return;
+        }
+
+        /* Couldn't set up a timer. Better early than never. */
+    }
+
+    flushdrag();
+}
+
+/* Time for the next frame while dragging. */
+void dragframe(void *data)
+{
+    (void) data;
+
+    drag.timer = NULL;
+    applydrag();
+}
+
+/*
+ * Move or resize the window we're dragging to the latest position
+ * right now.
+ */
+void flushdrag(void)
+{
+    if (NULL != drag.timer)
+    {
+        deltimer(drag.timer);
+        drag.timer = NULL;
+    }
+
+    if (!drag.pending)
+    {
+        return;
+    }
+
+    drag.pending = false;
+
+    if (NULL == focuswin || focuswin->maxed)
+    {
+        return;
+    }
+
+    /*
+     * Our pointer is moving and since we even get this event we're
+     * either resizing or moving a window.
+     */
+    if (mode == MCWM_MOVE)
+    {
+        mousemove(focuswin, drag.x, drag.y);
+    }
+    else if (mode == MCWM_RESIZE)
+    {
+        if (!drag.outline)
+        {
+            focuswin->stage.sync = true;
+        }
+        mouseresize(focuswin, drag.x, drag.y);
+    }
+    else
+    {
+        PDEBUG("Motion event when we're not moving our resizing!\n");
+        return;
+    }
+
+    if (drag.outline)
+    {
+        showoutline(focuswin);
+    }
+
+    drag.last = microseconds();
+
+    stats.dragupdates ++;
+    stats.draglatency += drag.last - drag.when;
+}
+
+/*
+ * Call fn with data when the reply to request number sequence
+ * arrives. The request must have been sent checked, so errors end up
+ * with fn and not in the event queue.
+ */
+void expectreply(unsigned int sequence, replyfn_t fn, void *data)
+{
+    struct waitreply *wait;
+
+    if (NULL == (wait = malloc(sizeof (struct waitreply))))
+    {
+        fprintf(stderr, "mcwm: Out of memory.\n");
+        xcb_discard_reply(conn, sequence);
+        return;
+    }
+
+    wait->sequence = sequence;
+    wait->fn = fn;
+    wait->data = data;
+    wait->next = NULL;
+
+    if (NULL == replytail)
+    {
+        replyhead = wait;
+    }
+    else
+    {
+        replytail->next = wait;
+    }
+
+    replytail = wait;
+}
+
+/*
+ * Call the callbacks of all requests whose replies have arrived.
+ * Replies come in the order we sent the requests, so we stop at the
+ * first one that isn't here yet.
+ *
+ * Returns true if we handled any replies.
+ */
+bool runreplies(void)
+{
+    struct waitreply *wait;
+    void *reply;
+    xcb_generic_error_t *error;
+    bool handled = false;
+
+    while (NULL != (wait = replyhead))
+    {
+        reply = NULL;
+        error = NULL;
+
+        if (0 == xcb_poll_for_reply(conn, wait->sequence, &reply, &error))
+        {
+            break;
+        }
+
+        /* Unlink first. The callback might send new requests. */
+        replyhead = wait->next;
+        if (NULL == replyhead)
+        {
+            replytail = NULL;
+        }
+
+        wait->fn(reply, error, wait->data);
+
+        free(reply);
+        free(error);
+        free(wait);
+
+        stats.replies ++;
+        handled = true;
+    }
+
+    return handled;
+}
+
+/*
+ * Remember that request number sequence will make the server send us
+ * an event of type about window win, so we can ignore it.
+ */
+void expectecho(unsigned int sequence, uint8_t type, xcb_window_t win)
+{
+    struct echo *echo = &echoes[sequence & (ECHO_SIZE - 1)];
+
+    echo->sequence = sequence;
+    echo->type = type;
+    echo->win = win;
+}
+
+/*
+ * Is ev just the echo of one of our own requests? Events caused by a
+ * request carry its sequence number, so this is a single lookup.
+ */
+bool isecho(xcb_generic_event_t *ev)
+{
+    struct echo *echo = &echoes[ev->full_sequence & (ECHO_SIZE - 1)];
+
+    /* Synthetic events come from clients, never from our requests. */
+    if (ev->response_type & 0x80
+        || echo->sequence != ev->full_sequence
+        || echo->type != ev->response_type)
+    {
+        return false;
+    }
+
+    return evwindow(ev) == echo->win;
+}
+
+/*
+ * Geometry values of client in mask have changed. Send them at the
+ * end of this turn of the event loop.
+ */
+void stagegeom(struct client *client, uint16_t mask)
+{
+    client->stage.dirty |= mask;
+    geomdirty = true;
+}
+
+/* Change the border width of client to width. */
+void stageborder(struct client *client, uint16_t width)
+{
+    client->borderwidth = width;
+    stagegeom(client, XCB_CONFIG_WINDOW_BORDER_WIDTH);
+}
+
+/*
+ * Restack client with stackmode, relative to sibling unless it's
+ * XCB_NONE.
+ */
+void stagestack(struct client *client, uint8_t stackmode,
+                xcb_window_t sibling)
+{
+    /*
+     * Two different stacking changes don't add up to the last one.
+     * Send the first before we forget it.
+     */
+    if ((client->stage.dirty & XCB_CONFIG_WINDOW_STACK_MODE)
+        && (client->stage.stackmode != stackmode
+            || client->stage.sibling != sibling))
+    {
+        commitgeom(client);
+    }
+
+    client->stage.stackmode = stackmode;
+    client->stage.sibling = sibling;
+
+    client->stage.dirty &= ~XCB_CONFIG_WINDOW_SIBLING;
+    if (XCB_NONE != sibling)
+    {
+        client->stage.dirty |= XCB_CONFIG_WINDOW_SIBLING;
+    }
+
+    stagegeom(client, XCB_CONFIG_WINDOW_STACK_MODE);
+}
+
+/*
+ * Send what's staged for client in one configure, leaving out values
+ * the server already has.
+ */
+void commitgeom(struct client *client)
+{
+    uint32_t values[7];
+    uint16_t dirty = client->stage.dirty;
+    uint16_t mask = 0;
+    int staged = 0;
+    int i = 0;
+
+    if (0 == dirty)
+    {
+        client->stage.sync = false;
+        return;
+    }
+
+    client->stage.dirty = 0;
+
+    if (dirty & XCB_CONFIG_WINDOW_X)
+    {
+        staged ++;
+        if (client->x != client->sent.x)
+        {
+            mask |= XCB_CONFIG_WINDOW_X;
+            values[i ++] = client->x;
+            client->sent.x = client->x;
+        }
+    }
+
+    if (dirty & XCB_CONFIG_WINDOW_Y)
+    {
+        staged ++;
+        if (client->y != client->sent.y)
+        {
+            mask |= XCB_CONFIG_WINDOW_Y;
+            values[i ++] = client->y;
+            client->sent.y = client->y;
+        }
+    }
+
+    if (dirty & XCB_CONFIG_WINDOW_WIDTH)
+    {
+        staged ++;
+        if (client->width != client->sent.width)
+        {
+            mask |= XCB_CONFIG_WINDOW_WIDTH;
+            values[i ++] = client->width;
+            client->sent.width = client->width;
+        }
+    }
+
+    if (dirty & XCB_CONFIG_WINDOW_HEIGHT)
+    {
+        staged ++;
+        if (client->height != client->sent.height)
+        {
+            mask |= XCB_CONFIG_WINDOW_HEIGHT;
+            values[i ++] = client->height;
+            client->sent.height = client->height;
+        }
+    }
+
+    if (dirty & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+    {
+        staged ++;
+        if (client->borderwidth != client->sentborder)
+        {
+            mask |= XCB_CONFIG_WINDOW_BORDER_WIDTH;
+            values[i ++] = client->borderwidth;
+            client->sentborder = client->borderwidth;
+        }
+        else
+        {
+            stats.borderskipped ++;
+        }
+    }
+
+    if (dirty & XCB_CONFIG_WINDOW_STACK_MODE)
+    {
+        xcb_window_t sibling = (dirty & XCB_CONFIG_WINDOW_SIBLING)
+            ? client->stage.sibling : XCB_NONE;
+
+        staged ++;
+        if (stacknoop(client->id, client->stage.stackmode, sibling))
+        {
+            stats.restackskipped ++;
+        }
+        else
+        {
+            if (XCB_NONE != sibling)
+            {
+                mask |= XCB_CONFIG_WINDOW_SIBLING;
+                values[i ++] = sibling;
+            }
+
+            mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+            values[i ++] = client->stage.stackmode;
+
+            restack(client->id, client->stage.stackmode, sibling);
+            stats.restacks ++;
+        }
+    }
+
+    stats.commitskipped += staged - (i - ((mask & XCB_CONFIG_WINDOW_SIBLING)
+                                          ? 1 : 0));
+
+    if (0 == mask)
+    {
+        /*
+         * Nothing changes, so the server won't tell the client. If it
+         * asked, we have to.
+         */
+        if (client->stage.notify)
+        {
+            sendconfnotify(client);
+        }
+        client->stage.notify = false;
+        client->stage.sync = false;
+        return;
+    }
+
+    client->stage.notify = false;
+
+    /*
+     * Only a new size makes the client redraw and update its
+     * counter. Anything else would leave us waiting for nothing.
+     */
+    if (client->stage.sync
+        && mask & (XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT))
+    {
+        syncrequest(client);
+    }
+    client->stage.sync = false;
+
+    client->lastconfigure = configurewin(client->id, mask, values);
+
+    stats.commits ++;
+    stats.commitvalues += i;
+}
+
+/* Send everything staged for all clients. */
+void commitall(void)
+{
+    struct item *item;
+
+    if (!geomdirty)
+    {
+        return;
+    }
+
+    geomdirty = false;
+
+    for (item = winlist; item != NULL; item = item->next)
+    {
+        commitgeom(item->data);
+    }
+}
+
+/*
+ * Tell client its geometry didn't change, as the ICCCM wants when we
+ * don't grant a configure request.
+ */
+void sendconfnotify(struct client *client)
+{
+    xcb_configure_notify_event_t ev = {
+      .response_type = XCB_CONFIGURE_NOTIFY,
+      .event = client->id,
+      .window = client->id,
+      .above_sibling = XCB_NONE,
+      .x = client->x,
+      .y = client->y,
+      .width = client->width,
+      .height = client->height,
+      .border_width = client->borderwidth,
+      .override_redirect = false
+    };
+
+    xcb_send_event(conn, false, client->id,
+                   XCB_EVENT_MASK_STRUCTURE_NOTIFY, (char *) &ev);
+}
+
+/* Find win in the stacking order. */
+struct stackwin *findstack(xcb_window_t win)
+{
+    struct item *item;
+    struct stackwin *sw;
+
+    for (item = stacklist; item != NULL; item = item->next)
+    {
+        sw = item->data;
+        if (win == sw->id)
+        {
+            return sw;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Add win on top of the stacking order, where new windows go, unless
+ * we know it already.
+ *
+ * Returns the entry or NULL if out of memory.
+ */
+struct stackwin *addstack(xcb_window_t win)
+{
+    struct item *item;
+    struct stackwin *sw;
+
+    if (NULL != (sw = findstack(win)))
+    {
+        return sw;
+    }
+
+    if (NULL == (item = additem(&stacklist)))
+    {
+        return NULL;
+    }
+
+    if (NULL == (sw = malloc(sizeof (struct stackwin))))
+    {
+        delitem(&stacklist, item);
+        return NULL;
+    }
+
+    sw->id = win;
+    sw->mapped = false;
+    sw->item = item;
+    item->data = sw;
+
+    return sw;
+}
+
+/* Forget about win in the stacking order. */
+void delstack(xcb_window_t win)
+{
+    struct stackwin *sw;
+
+    if (NULL != (sw = findstack(win)))
+    {
+        freeitem(&stacklist, NULL, sw->item);
+    }
+}
+
+/*
+ * Move win in our stacking order as the server does for stackmode
+ * relative to sibling, if any. We only know where it ends up for
+ * Above and Below. For the rest we wait for the ConfigureNotify.
+ */
+void restack(xcb_window_t win, uint8_t stackmode, xcb_window_t sibling)
+{
+    struct stackwin *sw;
+    struct stackwin *sib = NULL;
+    struct item *item;
+
+    if (NULL == (sw = findstack(win)))
+    {
+        return;
+    }
+
+    if (XCB_NONE != sibling && NULL == (sib = findstack(sibling)))
+    {
+        return;
+    }
+
+    switch (stackmode)
+    {
+    case XCB_STACK_MODE_ABOVE:
+        if (NULL == sib)
+        {
+            movetohead(&stacklist, sw->item);
+        }
+        else if (sib->item->prev != sw->item)
+        {
+            moveafter(&stacklist, sw->item, sib->item->prev);
+        }
+        break;
+
+    case XCB_STACK_MODE_BELOW:
+        if (NULL == sib)
+        {
+            for (item = sw->item; NULL != item->next; item = item->next)
+            {
+                ;
+            }
+            moveafter(&stacklist, sw->item, item);
+        }
+        else
+        {
+            moveafter(&stacklist, sw->item, sib->item);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Returns true if we know that restacking win with stackmode,
+ * relative to sibling if any, wouldn't change the stacking order.
+ *
+ * Above and Below move a window past unmapped ones too, and those
+ * show up again when mapped, so only the position counts. TopIf and
+ * BottomIf only do something if a mapped window is in the way.
+ */
+bool stacknoop(xcb_window_t win, uint8_t stackmode, xcb_window_t sibling)
+{
+    struct stackwin *sw;
+    struct stackwin *sib;
+    struct item *item;
+
+    if (NULL == (sw = findstack(win)))
+    {
+        return false;
+    }
+
+    if (XCB_NONE != sibling)
+    {
+        if (NULL == (sib = findstack(sibling)))
+        {
+            return false;
+        }
+
+        if (XCB_STACK_MODE_ABOVE == stackmode)
+        {
+            return sw->item->next == sib->item;
+        }
+        else if (XCB_STACK_MODE_BELOW == stackmode)
+        {
+            return sw->item->prev == sib->item;
+        }
+
+        return false;
+    }
+
+    switch (stackmode)
+    {
+    case XCB_STACK_MODE_ABOVE:
+        return NULL == sw->item->prev;
+
+    case XCB_STACK_MODE_BELOW:
+        return NULL == sw->item->next;
+
+    case XCB_STACK_MODE_TOP_IF:
+        /* Is anything visible above us? */
+        for (item = sw->item->prev; item != NULL; item = item->prev)
+        {
+            if (((struct stackwin *) item->data)->mapped)
+            {
+                return false;
+            }
+        }
+        return true;
+
+    case XCB_STACK_MODE_BOTTOM_IF:
+        /* Is anything visible below us? */
+        for (item = sw->item->next; item != NULL; item = item->next)
+        {
+            if (((struct stackwin *) item->data)->mapped)
+            {
+                return false;
+            }
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Keep our stacking order up to date with what happens to the
+ * children of root. Called for every event, our own included.
+ */
+void trackstack(xcb_generic_event_t *ev)
+{
+    struct stackwin *sw;
+
+    switch (ev->response_type & ~0x80)
+    {
+    case XCB_CREATE_NOTIFY:
+    {
+        xcb_create_notify_event_t *e = (xcb_create_notify_event_t *) ev;
+
+        if (e->parent == screen->root)
+        {
+            addstack(e->window);
+        }
+    }
+    break;
+
+    case XCB_DESTROY_NOTIFY:
+        delstack(((xcb_destroy_notify_event_t *) ev)->window);
+        break;
+
+    case XCB_REPARENT_NOTIFY:
+    {
+        xcb_reparent_notify_event_t *e = (xcb_reparent_notify_event_t *) ev;
+
+        if (e->parent == screen->root)
+        {
+            if (NULL != (sw = addstack(e->window)))
+            {
+                /* It's on top now, whatever it was before. */
+                movetohead(&stacklist, sw->item);
+            }
+        }
+        else
+        {
+            delstack(e->window);
+        }
+    }
+    break;
+
+    case XCB_MAP_NOTIFY:
+        if (NULL != (sw = findstack(((xcb_map_notify_event_t *) ev)->window)))
+        {
+            sw->mapped = true;
+        }
+        break;
+
+    case XCB_UNMAP_NOTIFY:
+        if (NULL != (sw = findstack(((xcb_unmap_notify_event_t *) ev)
+                                    ->window)))
+        {
+            sw->mapped = false;
+        }
+        break;
+
+    case XCB_CONFIGURE_NOTIFY:
+    {
+        xcb_configure_notify_event_t *e
+            = (xcb_configure_notify_event_t *) ev;
+
+        /* The window is now right above above_sibling, or at the bottom. */
+        if (XCB_NONE == e->above_sibling)
+        {
+            restack(e->window, XCB_STACK_MODE_BELOW, XCB_NONE);
+        }
+        else
+        {
+            restack(e->window, XCB_STACK_MODE_ABOVE, e->above_sibling);
+        }
+    }
+    break;
+
+    case XCB_CIRCULATE_NOTIFY:
+    {
+        xcb_circulate_notify_event_t *e
+            = (xcb_circulate_notify_event_t *) ev;
+
+        restack(e->window, XCB_PLACE_ON_TOP == e->place
+                ? XCB_STACK_MODE_ABOVE : XCB_STACK_MODE_BELOW, XCB_NONE);
+    }
+    break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Configure window win. We already know what we asked for, so we
+ * ignore the ConfigureNotify this generates.
+ *
+ * Returns the sequence number of the request.
+ */
+unsigned int configurewin(xcb_window_t win, uint16_t mask,
+                          const uint32_t *values)
+{
+    xcb_void_cookie_t cookie;
+
+    cookie = xcb_configure_window(conn, win, mask, values);
+    expectecho(cookie.sequence, XCB_CONFIGURE_NOTIFY, win);
+
+    return cookie.sequence;
+}
+
+/*
+ * Was ev generated after the server handled all our configure
+ * requests for client? If not, our own idea of its geometry is newer
+ * than what the event says.
+ */
+bool afterconfigure(struct client *client, xcb_generic_event_t *ev)
+{
+    return (int32_t) (ev->full_sequence - client->lastconfigure) >= 0;
+}
+
+#ifdef DEBUG
+
+/*
+ * Compare the geometry we think every client has with what the
+ * server says. Runs every VERIFY_INTERVAL milliseconds.
+ */
+void verifygeom(void *data)
+{
+    xcb_get_geometry_cookie_t cookie;
+    struct item *item;
+    struct client *client;
+    bool first = true;
+
+    for (item = winlist; item != NULL; item = item->next)
+    {
+        client = item->data;
+
+        cookie = xcb_get_geometry(conn, client->id);
+        expectreply(cookie.sequence, verifygeomreply,
+                    (void *) (uintptr_t) client->id);
+
+        if (first)
+        {
+            verifyseq = cookie.sequence;
+            first = false;
         }
     }
-    if (key == KEY_MAX)
-    {
-        PDEBUG("Unknown key pressed.\n");
 
-        /*
-         * We don't know what to do with this key. Send this key press
-         * event to the focused window.
-         */
-        xcb_send_event(conn, false, XCB_SEND_EVENT_DEST_ITEM_FOCUS,
-                       XCB_EVENT_MASK_NO_EVENT, (char *) ev);
-        xcb_flush(conn);
+    addtimer(VERIFY_INTERVAL, verifygeom, NULL);
+}
+
+/* The server's idea of a client's geometry arrived. */
+void verifygeomreply(void *reply, xcb_generic_error_t *error, void *data)
+{
+    xcb_get_geometry_reply_t *geom = reply;
+    struct client *client;
+
+    /*
+     * If we moved this client since we asked, we can't tell drift
+     * from changes the server hadn't seen yet.
+     */
+    if (NULL == geom || NULL == (client = findclient((uintptr_t) data))
+        || (int32_t) (client->lastconfigure - verifyseq) > 0)
+    {
         return;
     }
 
-    if (MCWM_TABBING == mode && key != KEY_TAB && key != KEY_BACKTAB)
+    /*
+     * Compare with what we last sent. The client's own fields might
+     * hold staged changes we haven't sent yet.
+     */
+    if (geom->x != client->sent.x || geom->y != client->sent.y
+        || geom->width != client->sent.width
+        || geom->height != client->sent.height)
     {
-        /* First finish tabbing around. Then deal with the next key. */
-        finishtabbing();
+        fprintf(stderr, "mcwm: Geometry of window %d drifted. We think "
+                "%dx%d+%d+%d, server says %dx%d+%d+%d.\n", client->id,
+                client->sent.width, client->sent.height, client->sent.x,
+                client->sent.y, geom->width, geom->height, geom->x, geom->y);
     }
+}
 
-    /* Is it shifted? */
-    if (ev->state & SHIFTMOD)
+#endif /* DEBUG */
+
+/*
+ * Warp the pointer to x,y relative to window win. We ignore the
+ * EnterNotify this generates, so if win isn't already focused the
+ * caller has to focus it.
+ */
+void warppointer(xcb_window_t win, int16_t x, int16_t y)
+{
+    xcb_void_cookie_t cookie;
+    struct client *client;
+    int16_t border;
+
+    /* The warp is relative to the window. Put it in place first. */
+    if (NULL != (client = findclient(win)))
     {
-        switch (key)
-        {
-        case KEY_H: /* h */
-            resizestep(focuswin, 'h');
-            break;
+        commitgeom(client);
+    }
 
-        case KEY_J: /* j */
-            resizestep(focuswin, 'j');
-            break;
+    cookie = xcb_warp_pointer(conn, XCB_NONE, win, 0, 0, 0, 0, x, y);
+    expectecho(cookie.sequence, XCB_ENTER_NOTIFY, win);
 
-        case KEY_K: /* k */
-            resizestep(focuswin, 'k');
-            break;
+    /*
+     * Now we know where the pointer will be. Any pointer event we
+     * haven't seen yet is older than that.
+     */
+    if (NULL != client)
+    {
+        border = client->borderwidth;
+        setpointer(client->x + border + x, client->y + border + y,
+                   cookie.sequence);
+    }
+    else
+    {
+        pointerpos.known = false;
+        pointerpos.sequence = cookie.sequence;
+    }
+}
 
-        case KEY_L: /* l */
-            resizestep(focuswin, 'l');
-            break;
+/* A window wants to be mapped. */
+void handle_maprequest(xcb_generic_event_t *ev)
+{
+    xcb_map_request_event_t *e;
 
-        case KEY_TAB: /* shifted tab counts as backtab */
-            focusnext(true);
-            break;
+    PDEBUG("event: Map request.\n");
+    e = (xcb_map_request_event_t *) ev;
+    newwin(e->window);
+}
 
-        default:
-            /* Ignore other shifted keys. */
-            break;
+/* A window was destroyed. */
+void handle_destroynotify(xcb_generic_event_t *ev)
+{
+    xcb_destroy_notify_event_t *e;
+
+    e = (xcb_destroy_notify_event_t *) ev;
+
+    /*
+     * If we had focus or our last focus in this window,
+     * forget about the focus.
+     *
+     * We will get an EnterNotify if there's another window
+     * under the pointer so we can set the focus proper later.
+     */
+    if (NULL != focuswin)
+    {
+        if (focuswin->id == e->window)
+        {
+            focuswin = NULL;
         }
     }
-    else
+    if (NULL != lastfocuswin)
     {
-        switch (key)
+        if (lastfocuswin->id == e->window)
         {
-        case KEY_RET: /* return */
-            start(conf.terminal);
-            break;
+            lastfocuswin = NULL;
+        }
+    }
 
-        case KEY_F: /* f */
-            fixwindow(focuswin, true);
-            break;
+    /*
+     * Find this window in list of clients and forget about
+     * it. If we were about to set it up, stop.
+     */
+    forgetwin(e->window);
+    forgetadopt(e->window);
+}
 
-        case KEY_H: /* h */
-            movestep(focuswin, 'h');
-            break;
+/* A mouse button was pressed. */
+void handle_buttonpress(xcb_generic_event_t *ev)
+{
+    xcb_button_press_event_t *e;
 
-        case KEY_J: /* j */
-            movestep(focuswin, 'j');
-            break;
+    e = (xcb_button_press_event_t *) ev;
+    PDEBUG("Button %d pressed in window %ld, subwindow %d "
+            "coordinates (%d,%d)\n",
+           e->detail, (long)e->event, e->child, e->event_x,
+           e->event_y);
 
-        case KEY_K: /* k */
-            movestep(focuswin, 'k');
-            break;
+    if (0 == e->child)
+    {
+        /* Mouse click on root window. Start programs? */
 
-        case KEY_L: /* l */
-            movestep(focuswin, 'l');
+        switch (e->detail)
+        {
+        case 1: /* Mouse button one. */
+            start(MOUSE1);
             break;
 
-        case KEY_TAB: /* tab */
-            focusnext(false);
+        case 2: /* Middle mouse button. */
+            start(MOUSE2);
             break;
 
-        case KEY_BACKTAB: /* backtab */
-            focusnext(true);
+        case 3: /* Mouse button three. */
+            start(MOUSE3);
             break;
 
-        case KEY_M: /* m */
-            maxvert(focuswin);
+        default:
             break;
+        } /* switch */
 
-        case KEY_R: /* r*/
-            raiseorlower(focuswin);
-            break;
+        return;
+    }
 
-        case KEY_X: /* x */
-            maximize(focuswin);
-            break;
+    /*
+     * If we don't have any currently focused window, we can't
+     * do anything. We don't want to do anything if the mouse
+     * cursor is in the wrong window (root window or a panel,
+     * for instance). There is a limit to sloppy focus.
+     */
+    if (NULL == focuswin || focuswin->id != e->child)
+    {
+        return;
+    }
 
-        case KEY_1:
-            changeworkspace(0);
-            break;
+    /*
+     * If middle button was pressed, raise window or lower
+     * it if it was already on top.
+     */
+    if (2 == e->detail)
+    {
+        raiseorlower(focuswin);
+    }
+    else
+    {
+        /* We're moving or resizing. */
 
-        case KEY_2:
-            changeworkspace(1);
-            break;
+        /*
+         * Save pointer position inside the window so we can go
+         * back to it when we're done moving or resizing. The
+         * event tells us where it is.
+         */
+        mode_x = e->root_x - focuswin->x - focuswin->borderwidth;
+        mode_y = e->root_y - focuswin->y - focuswin->borderwidth;
 
-        case KEY_3:
-            changeworkspace(2);
-            break;
+        /* Raise window. */
+        raisewindow(focuswin->id);
 
-        case KEY_4:
-            changeworkspace(3);
-            break;
+        drag.start = microseconds();
 
-        case KEY_5:
-            changeworkspace(4);
-            break;
+        /* Mouse button 1 was pressed. */
+        if (1 == e->detail)
+        {
+            mode = MCWM_MOVE;
 
-        case KEY_6:
-            changeworkspace(5);
-            break;
+            /*
+             * Warp pointer to upper left of window before
+             * starting move.
+             */
+            warppointer(focuswin->id, 1, 1);
+        }
+        else
+        {
+            /* Mouse button 3 was pressed. */
 
-        case KEY_7:
-            changeworkspace(6);
-            break;
+            mode = MCWM_RESIZE;
 
-        case KEY_8:
-            changeworkspace(7);
-            break;
+            /* Warp pointer to lower right. */
+            warppointer(focuswin->id, focuswin->width, focuswin->height);
+        }
 
-        case KEY_9:
-            changeworkspace(8);
-            break;
+        /*
+         * Take control of the pointer in the root window
+         * and confine it to root.
+         *
+         * Give us events when the key is released or if
+         * any motion occurs with the key held down. Unless we
+         * were asked to use the motion events directly, we
+         * only want hints.
+         *
+         * Keep updating everything else.
+         *
+         * Don't use any new cursor.
+         */
+        xcb_grab_pointer(conn, 0, screen->root,
+                         XCB_EVENT_MASK_BUTTON_RELEASE
+                         | XCB_EVENT_MASK_BUTTON_MOTION
+                         | (conf.directmotion ? 0
+                            : XCB_EVENT_MASK_POINTER_MOTION_HINT),
+                         XCB_GRAB_MODE_ASYNC,
+                         XCB_GRAB_MODE_ASYNC,
+                         screen->root,
+                         XCB_NONE,
+                         XCB_CURRENT_TIME);
 
-        case KEY_0:
-            changeworkspace(9);
-            break;
+        /*
+         * If we're only moving an outline, nobody else may draw
+         * while we do, or we can't erase it cleanly.
+         */
+        drag.outline = conf.outline || outlineclass(focuswin);
+        if (drag.outline)
+        {
+            xcb_grab_server(conn);
+            showoutline(focuswin);
+        }
 
-        case KEY_Y:
-            topleft();
-            break;
+        PDEBUG("mode now : %d\n", mode);
+    }
+}
 
-        case KEY_U:
-            topright();
-            break;
+/* The pointer moved while we were moving or resizing. */
+void handle_motionnotify(xcb_generic_event_t *ev)
+{
+    xcb_motion_notify_event_t *e = (xcb_motion_notify_event_t *) ev;
+    xcb_query_pointer_cookie_t cookie;
 
-        case KEY_B:
-            botleft();
-            break;
+    /*
+     * We can't do anything if we don't have a focused window
+     * or if it's fully maximized.
+     */
+    if (NULL == focuswin || focuswin->maxed)
+    {
+        return;
+    }
 
-        case KEY_N:
-            botright();
-            break;
+    if (!drag.pending)
+    {
+        drag.when = microseconds();
+    }
 
-        case KEY_END:
-            deletewin();
-            break;
+    if (conf.directmotion)
+    {
+        /*
+         * The event says where the pointer is. Just remember it.
+         * applydrag() moves the window once we've handled all
+         * events we have right now.
+         */
+        drag.x = e->root_x;
+        drag.y = e->root_y;
+        drag.pending = true;
+        return;
+    }
 
-        case KEY_PREVSCR:
-            prevscreen();
-            break;
+    /*
+     * This is not really a real notify, but just a hint that
+     * the mouse pointer moved. This means we need to get the
+     * current pointer position ourselves. We act on it in
+     * motionreply().
+     */
+    cookie = xcb_query_pointer(conn, screen->root);
+    expectreply(cookie.sequence, motionreply, NULL);
+}
 
-        case KEY_NEXTSCR:
-            nextscreen();
-            break;
+/* A mouse button was released. */
+void handle_buttonrelease(xcb_generic_event_t *ev)
+{
+    PDEBUG("Mouse button released! mode = %d\n", mode);
 
-        case KEY_ICONIFY:
-            if (conf.allowicons)
+    if (0 == mode)
+    {
+        /*
+         * Mouse button released, but not in a saved mode. Do
+         * nothing.
+         */
+        return;
+    }
+    else
+    {
+        int16_t x;
+        int16_t y;
+
+        /* We're finished moving or resizing. */
+
+        /* Catch up with the last motion first, whatever the time. */
+        flushdrag();
+
+        stats.dragtime += microseconds() - drag.start;
+
+        if (drag.outline)
+        {
+            /* Now move the real window to where the outline is. */
+            hideoutline();
+
+            if (NULL != focuswin)
             {
-                hide(focuswin);
+                stagegeom(focuswin, XCB_CONFIG_WINDOW_X
+                          | XCB_CONFIG_WINDOW_Y
+                          | XCB_CONFIG_WINDOW_WIDTH
+                          | XCB_CONFIG_WINDOW_HEIGHT);
             }
-            break;
 
-        case KEY_PREVWS:
-            if (curws > 0)
+            xcb_ungrab_server(conn);
+            drag.outline = false;
+        }
+
+        if (NULL == focuswin)
+        {
+            /*
+             * We don't seem to have a focused window! Just
+             * ungrab and reset the mode.
+             */
+            PDEBUG("No focused window when finished moving or "
+                   "resizing!");
+
+            xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+
+            mode = 0;
+            return;
+        }
+
+        /*
+         * We will get an EnterNotify and focus another window
+         * if the pointer just happens to be on top of another
+         * window when we ungrab the pointer, so we have to
+         * warp the pointer before to prevent this.
+         *
+         * Move to saved position within window or if that
+         * position is now outside current window, move inside
+         * window.
+         */
+        if (mode_x > focuswin->width)
+        {
+            x = focuswin->width / 2;
+            if (0 == x)
             {
-                changeworkspace(curws - 1);
+                x = 1;
             }
-            else
+
+        }
+        else
+        {
+            x = mode_x;
+        }
+
+        if (mode_y > focuswin->height)
+        {
+            y = focuswin->height / 2;
+            if (0 == y)
             {
-                changeworkspace(WORKSPACES - 1);
+                y = 1;
             }
-            break;
+        }
+        else
+        {
+            y = mode_y;
+        }
 
-        case KEY_NEXTWS:
-            changeworkspace((curws + 1) % WORKSPACES);
-            break;
+        warppointer(focuswin->id, x, y);
+        xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
 
-        default:
-            /* Ignore other keys. */
-            break;
-        } /* switch unshifted */
+        mode = 0;
+        PDEBUG("mode now = %d\n", mode);
     }
-} /* handle_keypress() */
+}
 
-/* Helper function to configure a window. */
-void configwin(xcb_window_t win, uint16_t mask, struct winconf wc)
+/* A key was released. */
+void handle_keyrelease(xcb_generic_event_t *ev)
 {
-    uint32_t values[7];
-    int i = -1;
+    xcb_key_release_event_t *e = (xcb_key_release_event_t *)ev;
+    unsigned i;
 
-    if (mask & XCB_CONFIG_WINDOW_X)
-    {
-        mask |= XCB_CONFIG_WINDOW_X;
-        i ++;
-        values[i] = wc.x;
-    }
+    PDEBUG("Key %d released.\n", e->detail);
 
-    if (mask & XCB_CONFIG_WINDOW_Y)
+    if (MCWM_TABBING == mode)
     {
-        mask |= XCB_CONFIG_WINDOW_Y;
-        i ++;
-        values[i] = wc.y;
-    }
+        /*
+         * Check if it's the that was released was a key
+         * generating the MODKEY mask.
+         */
+        for (i = 0; i < modkeys.len; i ++)
+        {
+            PDEBUG("Is it %d?\n", modkeys.keycodes[i]);
 
-    if (mask & XCB_CONFIG_WINDOW_WIDTH)
-    {
-        mask |= XCB_CONFIG_WINDOW_WIDTH;
-        i ++;
-        values[i] = wc.width;
-    }
+            if (e->detail == modkeys.keycodes[i])
+            {
+                finishtabbing();
 
-    if (mask & XCB_CONFIG_WINDOW_HEIGHT)
-    {
-        mask |= XCB_CONFIG_WINDOW_HEIGHT;
-        i ++;
-        values[i] = wc.height;
+                /* Get out of for... */
+                break;
+            }
+        }
     }
+}
 
-    if (mask & XCB_CONFIG_WINDOW_SIBLING)
+/*
+ * The pointer is now in client. Focus it and, unless we're tabbing,
+ * move it to the head of the workspace window list.
+ */
+void pointerfocus(struct client *client)
+{
+    if (client == focuswin)
     {
-        mask |= XCB_CONFIG_WINDOW_SIBLING;
-        i ++;
-        values[i] = wc.sibling;
+        return;
     }
 
-    if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    if (MCWM_TABBING != mode)
     {
-        mask |= XCB_CONFIG_WINDOW_STACK_MODE;
-        i ++;
-        values[i] = wc.stackmode;
-    }
+        /*
+         * We are focusing on a new window. Since we're not currently
+         * tabbing around the window ring, we need to update the
+         * current workspace window list: Move first the old focus to
+         * the head of the list and then the new focus to the head of
+         * the list.
+         */
+        if (NULL != focuswin)
+        {
+            movetohead(&wslist[curws], focuswin->wsitem[curws]);
+            lastfocuswin = NULL;
+        }
 
-    if (-1 != i)
-    {
-        xcb_configure_window(conn, win, mask, values);
-        xcb_flush(conn);
+        movetohead(&wslist[curws], client->wsitem[curws]);
     }
+
+    setfocus(client);
 }
 
-void configurerequest(xcb_configure_request_event_t *e)
+/* The pointer entered a window. */
+void handle_enternotify(xcb_generic_event_t *ev)
 {
+    xcb_enter_notify_event_t *e = (xcb_enter_notify_event_t *)ev;
     struct client *client;
-    struct winconf wc;
-    int16_t mon_x;
-    int16_t mon_y;
-    uint16_t mon_width;
-    uint16_t mon_height;
 
-    PDEBUG("event: Configure request. mask = %d\n", e->value_mask);
+    PDEBUG("event: Enter notify eventwin %d, child %d, detail %d.\n",
+           e->event,
+           e->child,
+           e->detail);
 
-    /* Find the client. */
-    if ((client = findclient(e->window)))
+    /*
+     * If this isn't a normal enter notify, don't bother.
+     *
+     * We also need ungrab events, since these will be
+     * generated on button and key grabs and if the user for
+     * some reason presses a button on the root and then moves
+     * the pointer to our window and releases the button, we
+     * get an Ungrab EnterNotify.
+     *
+     * The other cases means the pointer is grabbed and that
+     * either means someone is using it for menu selections or
+     * that we're moving or resizing. We don't want to change
+     * focus in those cases.
+     */
+    if (e->mode == XCB_NOTIFY_MODE_NORMAL
+        || e->mode == XCB_NOTIFY_MODE_UNGRAB)
     {
-        /* Find monitor position and size. */
-        if (NULL == client || NULL == client->monitor)
+        /*
+         * If we're entering the same window we focus now,
+         * then don't bother focusing.
+         */
+        if (NULL == focuswin || e->event != focuswin->id)
         {
-            mon_x = 0;
-            mon_y = 0;
-            mon_width = screen->width_in_pixels;
-            mon_height = screen->height_in_pixels;
+            /*
+             * Otherwise, set focus to the window we just
+             * entered if we can find it among the windows we
+             * know about. If not, just keep focus in the old
+             * window.
+             */
+            client = findclient(e->event);
+            if (NULL != client)
+            {
+                pointerfocus(client);
+            }
         }
-        else
+    }
+
+}
+
+/* A window changed size, position or stacking. */
+void handle_configurenotify(xcb_generic_event_t *ev)
+{
+    xcb_configure_notify_event_t *e
+        = (xcb_configure_notify_event_t *)ev;
+    struct adopt *adopt;
+    struct client *client;
+
+    if (NULL != (adopt = findadopt(e->window)))
+    {
+        adopt->geom.x = e->x;
+        adopt->geom.y = e->y;
+        adopt->geom.width = e->width;
+        adopt->geom.height = e->height;
+        adopt->gotgeom = true;
+    }
+
+    /*
+     * We update the geometry of our clients when we configure them
+     * and ignore the events that causes. Anything else that changes
+     * a window shows up here. Take it, unless one of our own
+     * configure requests is still on its way.
+     */
+    if (NULL != (client = findclient(e->window))
+        && afterconfigure(client, ev)
+        && 0 == client->stage.dirty)
+    {
+        if (client->x != e->x || client->y != e->y
+            || client->width != e->width || client->height != e->height)
         {
-            mon_x = client->monitor->x;
-            mon_y = client->monitor->y;
-            mon_width = client->monitor->width;
-            mon_height = client->monitor->height;
+            PDEBUG("Window %d changed behind our back to %dx%d+%d+%d.\n",
+                   e->window, e->width, e->height, e->x, e->y);
         }
 
-#if 0
+        client->x = e->x;
+        client->y = e->y;
+        client->width = e->width;
+        client->height = e->height;
+        client->sent.x = e->x;
+        client->sent.y = e->y;
+        client->sent.width = e->width;
+        client->sent.height = e->height;
+        client->sentborder = e->border_width;
+    }
+
+    if (e->window == screen->root)
+    {
         /*
-         * We ignore moves the user haven't initiated, that is do
-         * nothing on XCB_CONFIG_WINDOW_X and XCB_CONFIG_WINDOW_Y
-         * ConfigureRequests.
+         * When using RANDR or Xinerama, the root can change
+         * geometry when the user adds a new screen, tilts
+         * their screen 90 degrees or whatnot. We might need
+         * to rearrange windows to be visible.
          *
-         * Code here if we ever change our minds or if you, dear user,
-         * wants this functionality.
+         * We might get notified for several reasons, not just
+         * if the geometry changed. If the geometry is
+         * unchanged we do nothing.
          */
+        PDEBUG("Notify event for root!\n");
+        PDEBUG("Possibly a new root geometry: %dx%d\n",
+               e->width, e->height);
 
-        if (e->value_mask & XCB_CONFIG_WINDOW_X)
+        if (e->width == screen->width_in_pixels
+            && e->height == screen->height_in_pixels)
         {
-            /* Don't move window if maximized. Don't move off the screen. */
-            if (!client->maxed && e->x > 0)
-            {
-                client->x = e->x;
-            }
+            /* Root geometry is really unchanged. Do nothing. */
+            PDEBUG("Hey! Geometry didn't change.\n");
         }
-
-        if (e->value_mask & XCB_CONFIG_WINDOW_Y)
+        else
         {
-            /*
-             * Don't move window if maximized. Don't move off the
-             * screen.
-             */
-            if (!client->maxed && !client->vertmaxed && e->y > 0)
+            screen->width_in_pixels = e->width;
+            screen->height_in_pixels = e->height;
+
+            /* Check for RANDR. */
+            if (-1 == randrbase)
             {
-                client->y = e->y;
+                /* We have no RANDR so we rearrange windows to
+                 * the new root geometry here.
+                 *
+                 * With RANDR enabled, we handle this per
+                 * screen getrandr() when we receive an
+                 * XCB_RANDR_SCREEN_CHANGE_NOTIFY event.
+                 */
+                arrangewindows();
             }
         }
-#endif
+    }
+}
 
-        if (e->value_mask & XCB_CONFIG_WINDOW_WIDTH)
+/* Someone sent us a client message. */
+void handle_clientmessage(xcb_generic_event_t *ev)
+{
+    xcb_client_message_event_t *e
+        = (xcb_client_message_event_t *)ev;
+
+    if (conf.allowicons)
+    {
+        if (e->type == wm_change_state
+            && e->format == 32
+            && e->data.data32[0] == XCB_ICCCM_WM_STATE_ICONIC)
         {
-            /* Don't resize if maximized. */
-            if (!client->maxed)
-            {
-                client->width = e->width;
-            }
+            long data[] = { XCB_ICCCM_WM_STATE_ICONIC, XCB_NONE };
+
+            /* Unmap window and declare iconic. */
+
+            xcb_unmap_window(conn, e->window);
+            xcb_change_property(conn, XCB_PROP_MODE_REPLACE, e->window,
+                                wm_state, wm_state, 32, 2, data);
         }
+    }
+}
 
-        if (e->value_mask & XCB_CONFIG_WINDOW_HEIGHT)
+/* A client wants to be raised or lowered. */
+void handle_circulaterequest(xcb_generic_event_t *ev)
+{
+    xcb_circulate_request_event_t *e
+        = (xcb_circulate_request_event_t *)ev;
+
+    /*
+     * Subwindow e->window to parent e->event is about to be
+     * restacked.
+     *
+     * Just do what was requested, e->place is either
+     * XCB_PLACE_ON_TOP or _ON_BOTTOM. We don't care.
+     */
+    xcb_circulate_window(conn, e->window, e->place);
+}
+
+/* The keyboard or pointer mapping changed. */
+void handle_mappingnotify(xcb_generic_event_t *ev)
+{
+    xcb_mapping_notify_event_t *e
+        = (xcb_mapping_notify_event_t *)ev;
+
+    /*
+     * XXX Gah! We get a new notify message for *every* key!
+     * We want to know when the entire keyboard is finished.
+     * Impossible? Better handling somehow?
+     */
+
+    /*
+     * We're only interested in keys and modifiers, not
+     * pointer mappings, for instance.
+     */
+    if (e->request != XCB_MAPPING_MODIFIER
+        && e->request != XCB_MAPPING_KEYBOARD)
+    {
+        return;
+    }
+
+    /* Forget old key bindings. */
+    xcb_ungrab_key(conn, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
+
+    /* Use the new ones. */
+    setupkeys();
+}
+
+/* A window was unmapped. */
+void handle_unmapnotify(xcb_generic_event_t *ev)
+{
+    xcb_unmap_notify_event_t *e =
+        (xcb_unmap_notify_event_t *)ev;
+    struct item *item;
+    struct client *client;
+
+    /*
+     * Find the window in our *current* workspace list, then
+     * forget about it. If it gets mapped, we add it to our
+     * lists again then.
+     *
+     * Note that we might not know about the window we got the
+     * UnmapNotify event for. It might be a window with override
+     * redirect set. This is not an error. The windows we unmap
+     * ourselves when changing workspaces never get here, see
+     * isecho().
+     *
+     * XXX We might need to look in the global window list,
+     * after all. Consider if a window is unmapped on our last
+     * workspace while changing workspaces... If we do this,
+     * we need to keep track of our own windows and ignore
+     * UnmapNotify on them.
+     */
+    for (item = wslist[curws]; item != NULL; item = item->next)
+    {
+        client = item->data;
+
+        if (client->id == e->window)
         {
-            /* Don't resize if maximized. */
-            if (!client->maxed && !client->vertmaxed)
+            PDEBUG("Forgetting about %d\n", e->window);
+            if (focuswin == client)
             {
-                client->height = e->height;
+                focuswin = NULL;
             }
+
+            forgetclient(client);
+            /* We're finished. Break out of for loop. */
+            break;
         }
+    }
+}
 
-        /*
-         * XXX Do we really need to pass on sibling and stack mode
-         * configuration? Do we want to?
-         */
-        if (e->value_mask & XCB_CONFIG_WINDOW_SIBLING)
-        {
-            uint32_t values[1];
+/*
+ * A window was created. If it's a new top level window we will
+ * probably have to manage it soon, so start fetching what we need.
+ */
+void handle_createnotify(xcb_generic_event_t *ev)
+{
+    xcb_create_notify_event_t *e = (xcb_create_notify_event_t *) ev;
+    struct adopt *adopt;
 
-            values[0] = e->sibling;
-            xcb_configure_window(conn, e->window,
-                                 XCB_CONFIG_WINDOW_SIBLING,
-                                 values);
-            xcb_flush(conn);
+    if (e->parent != screen->root || e->override_redirect
+        || NULL != findclient(e->window) || NULL != findadopt(e->window))
+    {
+        return;
+    }
 
-        }
+    if (NULL == (adopt = newadopt(e->window)))
+    {
+        return;
+    }
 
-        if (e->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)
-        {
-            uint32_t values[1];
+    /* The event tells us the geometry. No need to ask. */
+    adopt->geom.x = e->x;
+    adopt->geom.y = e->y;
+    adopt->geom.width = e->width;
+    adopt->geom.height = e->height;
+    adopt->gotgeom = true;
+}
 
-            values[0] = e->stack_mode;
-            xcb_configure_window(conn, e->window,
-                                 XCB_CONFIG_WINDOW_STACK_MODE,
-                                 values);
-            xcb_flush(conn);
-        }
+/*
+ * A window was moved to a new parent. If it's no longer a top level
+ * window we won't manage it.
+ */
+void handle_reparentnotify(xcb_generic_event_t *ev)
+{
+    xcb_reparent_notify_event_t *e = (xcb_reparent_notify_event_t *) ev;
 
-        /* Check if window fits on screen after resizing. */
+    if (e->parent != screen->root)
+    {
+        forgetadopt(e->window);
+    }
+}
 
-        if (client->x + client->width + 2 * conf.borderwidth
-            > mon_x + mon_width)
-        {
-            /*
-             * See if it fits if we move away the window from the
-             * right edge of the screen.
-             */
-            client->x = mon_x + mon_width
-                - (client->width + 2 * conf.borderwidth);
+/*
+ * A property changed on a window. Fetch it again if it's one we keep
+ * in the property cache.
+ */
+void handle_propertynotify(xcb_generic_event_t *ev)
+{
+    xcb_property_notify_event_t *e = (xcb_property_notify_event_t *) ev;
 
-            /*
-             * If we moved over the left screen edge, move back and
-             * fit exactly on screen.
-             */
-            if (client->x < mon_x)
-            {
-                client->x = mon_x;
-                client->width = mon_width - 2 * conf.borderwidth;
-            }
-        }
+    if (NULL != findprops(e->window))
+    {
+        fetchprop(e->window, e->atom);
+    }
+}
+
+/* The screen changed size or outputs were added or removed. */
+void handle_randrscreenchange(xcb_generic_event_t *ev)
+{
+    /* Note that we ignore XCB_RANDR_NOTIFY. */
+    PDEBUG("RANDR screen change notify. Checking outputs.\n");
+    getrandr();
+}
+
+/*
+ * A sync alarm fired. If it's a client's counter reaching the value
+ * we asked for, the client has caught up with the last size we sent
+ * and is ready for another one.
+ */
+void handle_syncalarm(xcb_generic_event_t *ev)
+{
+    xcb_sync_alarm_notify_event_t *e = (xcb_sync_alarm_notify_event_t *) ev;
+    struct item *item;
+    struct client *client;
+    int64_t value;
 
-        if (client->y + client->height + 2 * conf.borderwidth
-            > mon_y + mon_height)
+    for (item = winlist; item != NULL; item = item->next)
+    {
+        client = item->data;
+        if (client->sync.alarm == e->alarm)
         {
-            /*
-             * See if it fits if we move away the window from the
-             * bottom edge.
-             */
-            client->y = mon_y + mon_height
-                - (client->height + 2 * conf.borderwidth);
-
-            /*
-             * If we moved over the top screen edge, move back and fit
-             * on screen.
-             */
-            if (client->y < mon_y)
-            {
-                PDEBUG("over the edge: y < %d\n", mon_y);
-                client->y = mon_y;
-                client->height = mon_height - 2 * conf.borderwidth;
-            }
+            break;
         }
+    }
 
-        moveresize(client->id, client->x, client->y, client->width,
-                   client->height);
+    if (NULL == item)
+    {
+        return;
     }
-    else
+
+    value = ((int64_t) e->counter_value.hi << 32) | e->counter_value.lo;
+    if (value < client->sync.value)
     {
-        PDEBUG("We don't know about this window yet.\n");
+        /* Still behind. */
+        return;
+    }
 
-        /*
-         * Unmapped window. Just pass all options except border
-         * width.
-         */
-        wc.x = e->x;
-        wc.y = e->y;
-        wc.width = e->width;
-        wc.height = e->height;
-        wc.sibling = e->sibling;
-        wc.stackmode = e->stack_mode;
+    client->sync.waiting = false;
+    client->sync.unresponsive = false;
 
-        configwin(e->window, e->value_mask, wc);
+    if (NULL != client->sync.timer)
+    {
+        deltimer(client->sync.timer);
+        client->sync.timer = NULL;
+    }
+
+    replaysteps(client);
+
+    if (MCWM_RESIZE == mode && client == focuswin)
+    {
+        applydrag();
     }
 }
 
-void events(void)
+/*
+ * Call fn for events of type. name is used in debug output and
+ * statistics. If name is NULL we use the core event name.
+ */
+void sethandler(uint8_t type, handlerfn_t fn, const char *name)
 {
-    xcb_generic_event_t *ev;
+    type &= ~0x80;
 
-    int16_t mode_x = 0;             /* X coord when in special mode */
-    int16_t mode_y = 0;             /* Y coord when in special mode */
-    int fd;                         /* Our X file descriptor */
-    fd_set in;                      /* For select */
-    int found;                      /* Ditto. */
+    handlers[type].fn = fn;
 
-    /* Get the file descriptor so we can do select() on it. */
-    fd = xcb_get_file_descriptor(conn);
-
-    for (sigcode = 0; 0 == sigcode;)
+    if (NULL == name && type <= MAXEVENTS)
     {
-        /* Prepare for select(). */
-        FD_ZERO(&in);
-        FD_SET(fd, &in);
-
-        /*
-         * Check for events, again and again. When poll returns NULL
-         * (and it does that a lot), we block on select() until the
-         * event file descriptor gets readable again.
-         *
-         * We do it this way instead of xcb_wait_for_event() since
-         * select() will return if we were interrupted by a signal. We
-         * like that.
-         */
-        ev = xcb_poll_for_event(conn);
-        if (NULL == ev)
-        {
-            PDEBUG("xcb_poll_for_event() returned NULL.\n");
-
-            /*
-             * Check if we have an unrecoverable connection error,
-             * like a disconnected X server.
-             */
-            if (xcb_connection_has_error(conn))
-            {
-                cleanup(0);
-                exit(1);
-            }
+        name = evnames[type];
+    }
+    handlers[type].name = name;
+}
 
-            found = select(fd + 1, &in, NULL, NULL, NULL);
-            if (-1 == found)
-            {
-                if (EINTR == errno)
-                {
-                    /* We received a signal. Break out of loop. */
-                    break;
-                }
-                else
-                {
-                    /* Something was seriously wrong with select(). */
-                    fprintf(stderr, "mcwm: select failed.");
-                    cleanup(0);
-                    exit(1);
-                }
-            }
-            else
-            {
-                /* We found more events. Goto start of loop. */
-                continue;
-            }
-        }
+/* Set up handlers for the core events we care about. */
+void setuphandlers(void)
+{
+    sethandler(XCB_MAP_REQUEST, handle_maprequest, NULL);
+    sethandler(XCB_DESTROY_NOTIFY, handle_destroynotify, NULL);
+    sethandler(XCB_BUTTON_PRESS, handle_buttonpress, NULL);
+    sethandler(XCB_MOTION_NOTIFY, handle_motionnotify, NULL);
+    sethandler(XCB_BUTTON_RELEASE, handle_buttonrelease, NULL);
+    sethandler(XCB_KEY_PRESS, handle_keypress, NULL);
+    sethandler(XCB_KEY_RELEASE, handle_keyrelease, NULL);
+    sethandler(XCB_ENTER_NOTIFY, handle_enternotify, NULL);
+    sethandler(XCB_CONFIGURE_NOTIFY, handle_configurenotify, NULL);
+    sethandler(XCB_CONFIGURE_REQUEST, handle_configurerequest, NULL);
+    sethandler(XCB_CLIENT_MESSAGE, handle_clientmessage, NULL);
+    sethandler(XCB_CIRCULATE_REQUEST, handle_circulaterequest, NULL);
+    sethandler(XCB_MAPPING_NOTIFY, handle_mappingnotify, NULL);
+    sethandler(XCB_UNMAP_NOTIFY, handle_unmapnotify, NULL);
+    sethandler(XCB_CREATE_NOTIFY, handle_createnotify, NULL);
+    sethandler(XCB_REPARENT_NOTIFY, handle_reparentnotify, NULL);
+    sethandler(XCB_PROPERTY_NOTIFY, handle_propertynotify, NULL);
+}
 
-#ifdef DEBUG
-        if (ev->response_type <= MAXEVENTS)
-        {
-            PDEBUG("Event: %s\n", evnames[ev->response_type]);
-        }
-        else
-        {
-            PDEBUG("Event: #%d. Not known.\n", ev->response_type);
-        }
-#endif
+/*
+ * Look up the handler for ev in the handler table and call it. Keeps
+ * count of how many events of each type we got and, if we're
+ * collecting statistics, how long we spent handling them.
+ */
+void handleevent(xcb_generic_event_t *ev)
+{
+    struct handler *handler;
+    struct timespec before;
+    struct timespec after;
 
-        /* Note that we ignore XCB_RANDR_NOTIFY. */
-        if (ev->response_type
-            == randrbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY)
-        {
-            PDEBUG("RANDR screen change notify. Checking outputs.\n");
-            getrandr();
-            free(ev);
-            continue;
-        }
+    trackpointer(ev);
+    trackstack(ev);
 
-        switch (ev->response_type & ~0x80)
-        {
-        case XCB_MAP_REQUEST:
-        {
-            xcb_map_request_event_t *e;
+    if (isecho(ev))
+    {
+        PDEBUG("Event: Our own %d for sequence %u. Ignored.\n",
+               ev->response_type, ev->full_sequence);
+        stats.echoes ++;
+        return;
+    }
 
-            PDEBUG("event: Map request.\n");
-            e = (xcb_map_request_event_t *) ev;
-            newwin(e->window);
-        }
-        break;
+    handler = &handlers[ev->response_type & ~0x80];
+    handler->count ++;
 
-        case XCB_DESTROY_NOTIFY:
-        {
-            xcb_destroy_notify_event_t *e;
+    if (NULL == handler->fn)
+    {
+        PDEBUG("Event: #%d. Not handled.\n", ev->response_type);
+        return;
+    }
 
-            e = (xcb_destroy_notify_event_t *) ev;
+    PDEBUG("Event: %s\n", handler->name);
 
-            /*
-             * If we had focus or our last focus in this window,
-             * forget about the focus.
-             *
-             * We will get an EnterNotify if there's another window
-             * under the pointer so we can set the focus proper later.
-             */
-            if (NULL != focuswin)
-            {
-                if (focuswin->id == e->window)
-                {
-                    focuswin = NULL;
-                }
-            }
-            if (NULL != lastfocuswin)
-            {
-                if (lastfocuswin->id == e->window)
-                {
-                    lastfocuswin = NULL;
-                }
-            }
+    if (!conf.stats)
+    {
+        handler->fn(ev);
+        return;
+    }
 
-            /*
-             * Find this window in list of clients and forget about
-             * it.
-             */
-            forgetwin(e->window);
-        }
-        break;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    handler->fn(ev);
+    clock_gettime(CLOCK_MONOTONIC, &after);
 
-        case XCB_BUTTON_PRESS:
-        {
-            xcb_button_press_event_t *e;
+    handler->nsec += (after.tv_sec - before.tv_sec) * 1000000000ULL
+        + after.tv_nsec - before.tv_nsec;
+}
 
-            e = (xcb_button_press_event_t *) ev;
-            PDEBUG("Button %d pressed in window %ld, subwindow %d "
-                    "coordinates (%d,%d)\n",
-                   e->detail, (long)e->event, e->child, e->event_x,
-                   e->event_y);
+/*
+ * Read every event the server has sent us so far into the event ring,
+ * but not more than fits.
+ *
+ * Returns number of events now waiting in the ring.
+ */
+unsigned drainevents(void)
+{
+    xcb_generic_event_t *ev;
 
-            if (0 == e->child)
-            {
-                /* Mouse click on root window. Start programs? */
+    /*
+     * Only the first poll may read from the socket. The rest just
+     * empty what XCB has already buffered.
+     */
+    for (ev = xcb_poll_for_event(conn); NULL != ev;
+         ev = xcb_poll_for_queued_event(conn))
+    {
+        evring.ev[(evring.head + evring.len) % EVRING_SIZE] = ev;
+        evring.len ++;
 
-                switch (e->detail)
-                {
-                case 1: /* Mouse button one. */
-                    start(MOUSE1);
-                    break;
+        if (EVRING_SIZE == evring.len)
+        {
+            break;
+        }
+    }
 
-                case 2: /* Middle mouse button. */
-                    start(MOUSE2);
-                    break;
+    return evring.len;
+}
 
-                case 3: /* Mouse button three. */
-                    start(MOUSE3);
-                    break;
+/*
+ * Forget about event number i in the ring. We keep the slot so the
+ * order of the other events doesn't change.
+ */
+void dropevent(unsigned i)
+{
+    free(evring.ev[(evring.head + i) % EVRING_SIZE]);
+    evring.ev[(evring.head + i) % EVRING_SIZE] = NULL;
+    evring.repeats[(evring.head + i) % EVRING_SIZE] = 0;
+    stats.coalesced ++;
+}
 
-                default:
-                    break;
-                } /* switch */
+/*
+ * Is e a key press that moves or resizes a window one step? Those we
+ * can do several of at once.
+ */
+bool stepkey(const xcb_key_press_event_t *e)
+{
+    if (0 == e->detail)
+    {
+        return false;
+    }
 
-                /* Break out of event switch. */
-                break;
-            }
+    return e->detail == keys[KEY_H].keycode
+        || e->detail == keys[KEY_J].keycode
+        || e->detail == keys[KEY_K].keycode
+        || e->detail == keys[KEY_L].keycode;
+}
 
-            /*
-             * If we don't have any currently focused window, we can't
-             * do anything. We don't want to do anything if the mouse
-             * cursor is in the wrong window (root window or a panel,
-             * for instance). There is a limit to sloppy focus.
-             */
-            if (NULL == focuswin || focuswin->id != e->child)
-            {
-                break;
-            }
+/*
+ * Merge configure request e into a later request l for the same
+ * window. Values l asks for win over the ones in e.
+ */
+void mergeconfreq(xcb_configure_request_event_t *e,
+                  xcb_configure_request_event_t *l)
+{
+    uint16_t mask = e->value_mask & ~l->value_mask;
 
-            /*
-             * If middle button was pressed, raise window or lower
-             * it if it was already on top.
-             */
-            if (2 == e->detail)
-            {
-                raiseorlower(focuswin);
-            }
-            else
-            {
-                int16_t pointx;
-                int16_t pointy;
+    if (mask & XCB_CONFIG_WINDOW_X)
+    {
+        l->x = e->x;
+    }
 
-                /* We're moving or resizing. */
+    if (mask & XCB_CONFIG_WINDOW_Y)
+    {
+        l->y = e->y;
+    }
 
-                /*
-                 * Get and save pointer position inside the window
-                 * so we can go back to it when we're done moving
-                 * or resizing.
-                 */
-                if (!getpointer(focuswin->id, &pointx, &pointy))
-                {
-                    break;
-                }
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)
+    {
+        l->width = e->width;
+    }
 
-                mode_x = pointx;
-                mode_y = pointy;
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+    {
+        l->height = e->height;
+    }
 
-                /* Raise window. */
-                raisewindow(focuswin->id);
+    if (mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+    {
+        l->border_width = e->border_width;
+    }
 
-                /* Mouse button 1 was pressed. */
-                if (1 == e->detail)
-                {
-                    mode = MCWM_MOVE;
+    if (mask & XCB_CONFIG_WINDOW_SIBLING)
+    {
+        l->sibling = e->sibling;
+    }
 
-                    /*
-                     * Warp pointer to upper left of window before
-                     * starting move.
-                     */
-                    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                                     1, 1);
-                }
-                else
-                {
-                    /* Mouse button 3 was pressed. */
+    if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+    {
+        l->stack_mode = e->stack_mode;
+    }
 
-                    mode = MCWM_RESIZE;
+    l->value_mask |= mask;
+}
 
-                    /* Warp pointer to lower right. */
-                    xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0,
-                                     0, focuswin->width, focuswin->height);
-                }
+/*
+ * Does event ev change what a pending configure request for window
+ * win would mean? If so, we can't move the request past it.
+ */
+bool confbarrier(xcb_generic_event_t *ev, xcb_window_t win)
+{
+    switch (ev->response_type & ~0x80)
+    {
+    case XCB_MAP_REQUEST:
+        return ((xcb_map_request_event_t *) ev)->window == win;
 
-                /*
-                 * Take control of the pointer in the root window
-                 * and confine it to root.
-                 *
-                 * Give us events when the key is released or if
-                 * any motion occurs with the key held down.
-                 *
-                 * Keep updating everything else.
-                 *
-                 * Don't use any new cursor.
-                 */
-                xcb_grab_pointer(conn, 0, screen->root,
-                                 XCB_EVENT_MASK_BUTTON_RELEASE
-                                 | XCB_EVENT_MASK_BUTTON_MOTION
-                                 | XCB_EVENT_MASK_POINTER_MOTION_HINT,
-                                 XCB_GRAB_MODE_ASYNC,
-                                 XCB_GRAB_MODE_ASYNC,
-                                 screen->root,
-                                 XCB_NONE,
-                                 XCB_CURRENT_TIME);
-
-                xcb_flush(conn);
-
-                PDEBUG("mode now : %d\n", mode);
-            }
-        }
-        break;
+    case XCB_MAP_NOTIFY:
+        return ((xcb_map_notify_event_t *) ev)->window == win;
 
-        case XCB_MOTION_NOTIFY:
-        {
-            xcb_query_pointer_reply_t *pointer;
+    case XCB_UNMAP_NOTIFY:
+        return ((xcb_unmap_notify_event_t *) ev)->window == win;
 
-            /*
-             * We can't do anything if we don't have a focused window
-             * or if it's fully maximized.
-             */
-            if (NULL == focuswin || focuswin->maxed)
-            {
-                break;
-            }
+    case XCB_REPARENT_NOTIFY:
+        return ((xcb_reparent_notify_event_t *) ev)->window == win;
 
-            /*
-             * This is not really a real notify, but just a hint that
-             * the mouse pointer moved. This means we need to get the
-             * current pointer position ourselves.
-             */
-            pointer = xcb_query_pointer_reply(
-                conn, xcb_query_pointer(conn, screen->root), 0);
+    case XCB_DESTROY_NOTIFY:
+        return ((xcb_destroy_notify_event_t *) ev)->window == win;
 
-            if (NULL == pointer)
-            {
-                PDEBUG("Couldn't get pointer position.\n");
-                break;
-            }
+    default:
+        return false;
+    }
+}
 
-            /*
-             * Our pointer is moving and since we even get this event
-             * we're either resizing or moving a window.
-             */
-            if (mode == MCWM_MOVE)
-            {
-                mousemove(focuswin, pointer->root_x, pointer->root_y);
-            }
-            else if (mode == MCWM_RESIZE)
-            {
-                mouseresize(focuswin, pointer->root_x, pointer->root_y);
-            }
-            else
-            {
-                PDEBUG("Motion event when we're not moving our resizing!\n");
-            }
+/*
+ * Throw away events in the ring that are superseded by later events
+ * in the same batch:
+ *
+ * - A MotionNotify followed by another motion in the same window
+ *   before any button is pressed or released. We only care about
+ *   where the pointer ended up.
+ *
+ * - An EnterNotify followed by another EnterNotify we're going to
+ *   focus on, with no key or button event or window going away in
+ *   between. Focusing the first window would be undone at once.
+ *
+ * - A ConfigureRequest followed by another request for the same
+ *   window. The earlier one is merged into the later one.
+ */
+void coalesce(void)
+{
+    xcb_generic_event_t *ev;
+    xcb_generic_event_t *later;
+    unsigned i;
+    unsigned j;
 
-            free(pointer);
+    for (i = 0; i < evring.len; i ++)
+    {
+        ev = evring.ev[(evring.head + i) % EVRING_SIZE];
+        if (NULL == ev)
+        {
+            continue;
         }
 
-        break;
-
-        case XCB_BUTTON_RELEASE:
-            PDEBUG("Mouse button released! mode = %d\n", mode);
-
-            if (0 == mode)
+        for (j = i + 1; j < evring.len; j ++)
+        {
+            later = evring.ev[(evring.head + j) % EVRING_SIZE];
+            if (NULL == later)
             {
-                /*
-                 * Mouse button released, but not in a saved mode. Do
-                 * nothing.
-                 */
-                break;
+                continue;
             }
-            else
-            {
-                int16_t x;
-                int16_t y;
 
-                /* We're finished moving or resizing. */
+            switch (ev->response_type & ~0x80)
+            {
+            case XCB_KEY_PRESS:
+            {
+                xcb_key_press_event_t *e = (xcb_key_press_event_t *) ev;
+                xcb_key_press_event_t *l = (xcb_key_press_event_t *) later;
+                unsigned slot = (evring.head + j) % EVRING_SIZE;
 
-                if (NULL == focuswin)
+                /*
+                 * Holding down a key to move or resize a window gives
+                 * us a key press for every autorepeat. Add them up
+                 * and take all steps at once in the last press.
+                 */
+                if (!stepkey(e))
                 {
-                    /*
-                     * We don't seem to have a focused window! Just
-                     * ungrab and reset the mode.
-                     */
-                    PDEBUG("No focused window when finished moving or "
-                           "resizing!");
-
-                    xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
-                    xcb_flush(conn); /* Important! */
-
-                    mode = 0;
+                    j = evring.len;
                     break;
                 }
 
-                /*
-                 * We will get an EnterNotify and focus another window
-                 * if the pointer just happens to be on top of another
-                 * window when we ungrab the pointer, so we have to
-                 * warp the pointer before to prevent this.
-                 *
-                 * Move to saved position within window or if that
-                 * position is now outside current window, move inside
-                 * window.
-                 */
-                if (mode_x > focuswin->width)
+                switch (later->response_type & ~0x80)
                 {
-                    x = focuswin->width / 2;
-                    if (0 == x)
+                case XCB_KEY_PRESS:
+                    if (l->detail == e->detail && l->state == e->state
+                        && l->event == e->event)
                     {
-                        x = 1;
+                        evring.repeats[slot] += 1
+                            + evring.repeats[(evring.head + i) % EVRING_SIZE];
+                        dropevent(i);
+                        stats.keyrepeats ++;
                     }
+                    j = evring.len;
+                    break;
 
-                }
-                else
-                {
-                    x = mode_x;
-                }
-
-                if (mode_y > focuswin->height)
-                {
-                    y = focuswin->height / 2;
-                    if (0 == y)
+                case XCB_KEY_RELEASE:
+                    /* Autorepeat might release between presses. */
+                    if (l->detail != e->detail)
                     {
-                        y = 1;
+                        j = evring.len;
                     }
-                }
-                else
-                {
-                    y = mode_y;
-                }
+                    break;
 
-                xcb_warp_pointer(conn, XCB_NONE, focuswin->id, 0, 0, 0, 0,
-                                 x, y);
-                xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
-                xcb_flush(conn); /* Important! */
+                case XCB_MOTION_NOTIFY:
+                case XCB_CONFIGURE_NOTIFY:
+                case XCB_PROPERTY_NOTIFY:
+                    /* Nothing that changes what the key does. */
+                    break;
 
-                mode = 0;
-                PDEBUG("mode now = %d\n", mode);
+                default:
+                    j = evring.len;
+                    break;
+                }
             }
-        break;
-
-        case XCB_KEY_PRESS:
-        {
-            xcb_key_press_event_t *e = (xcb_key_press_event_t *)ev;
-
-            PDEBUG("Key %d pressed\n", e->detail);
-
-            handle_keypress(e);
-        }
-        break;
-
-        case XCB_KEY_RELEASE:
-        {
-            xcb_key_release_event_t *e = (xcb_key_release_event_t *)ev;
-            unsigned i;
-
-            PDEBUG("Key %d released.\n", e->detail);
+            break;
 
-            if (MCWM_TABBING == mode)
-            {
-                /*
-                 * Check if it's the that was released was a key
-                 * generating the MODKEY mask.
-                 */
-                for (i = 0; i < modkeys.len; i ++)
+            case XCB_MOTION_NOTIFY:
+                switch (later->response_type & ~0x80)
                 {
-                    PDEBUG("Is it %d?\n", modkeys.keycodes[i]);
+                case XCB_BUTTON_PRESS:
+                case XCB_BUTTON_RELEASE:
+                    /* Keep this motion. */
+                    j = evring.len;
+                    break;
 
-                    if (e->detail == modkeys.keycodes[i])
+                case XCB_MOTION_NOTIFY:
+                    if (((xcb_motion_notify_event_t *) ev)->event
+                        == ((xcb_motion_notify_event_t *) later)->event)
                     {
-                        finishtabbing();
-
-                        /* Get out of for... */
-                        break;
+                        dropevent(i);
+                        j = evring.len;
                     }
+                    break;
                 }
-            }
-        }
-        break;
-
-        case XCB_ENTER_NOTIFY:
-        {
-            xcb_enter_notify_event_t *e = (xcb_enter_notify_event_t *)ev;
-            struct client *client;
+                break;
 
-            PDEBUG("event: Enter notify eventwin %d, child %d, detail %d.\n",
-                   e->event,
-                   e->child,
-                   e->detail);
+            case XCB_ENTER_NOTIFY:
+                switch (later->response_type & ~0x80)
+                {
+                case XCB_KEY_PRESS:
+                case XCB_KEY_RELEASE:
+                case XCB_BUTTON_PRESS:
+                case XCB_BUTTON_RELEASE:
+                case XCB_MAP_REQUEST:
+                case XCB_UNMAP_NOTIFY:
+                case XCB_DESTROY_NOTIFY:
+                    j = evring.len;
+                    break;
 
-            /*
-             * If this isn't a normal enter notify, don't bother.
-             *
-             * We also need ungrab events, since these will be
-             * generated on button and key grabs and if the user for
-             * some reason presses a button on the root and then moves
-             * the pointer to our window and releases the button, we
-             * get an Ungrab EnterNotify.
-             *
-             * The other cases means the pointer is grabbed and that
-             * either means someone is using it for menu selections or
-             * that we're moving or resizing. We don't want to change
-             * focus in those cases.
-             */
-            if (e->mode == XCB_NOTIFY_MODE_NORMAL
-                || e->mode == XCB_NOTIFY_MODE_UNGRAB)
-            {
-                /*
-                 * If we're entering the same window we focus now,
-                 * then don't bother focusing.
-                 */
-                if (NULL == focuswin || e->event != focuswin->id)
+                case XCB_ENTER_NOTIFY:
                 {
+                    xcb_enter_notify_event_t *e
+                        = (xcb_enter_notify_event_t *) later;
+
                     /*
-                     * Otherwise, set focus to the window we just
-                     * entered if we can find it among the windows we
-                     * know about. If not, just keep focus in the old
-                     * window.
+                     * Only a later enter we will actually act on
+                     * makes this one useless.
                      */
-                    client = findclient(e->event);
-                    if (NULL != client)
+                    if ((e->mode == XCB_NOTIFY_MODE_NORMAL
+                         || e->mode == XCB_NOTIFY_MODE_UNGRAB)
+                        && NULL != findclient(e->event))
                     {
-                        if (MCWM_TABBING != mode)
-                        {
-                            /*
-                             * We are focusing on a new window. Since
-                             * we're not currently tabbing around the
-                             * window ring, we need to update the
-                             * current workspace window list: Move
-                             * first the old focus to the head of the
-                             * list and then the new focus to the head
-                             * of the list.
-                             */
-                            if (NULL != focuswin)
-                            {
-                                movetohead(&wslist[curws],
-                                           focuswin->wsitem[curws]);
-                                lastfocuswin = NULL;
-                            }
-
-                            movetohead(&wslist[curws], client->wsitem[curws]);
-                        }
-
-                        setfocus(client);
+                        dropevent(i);
+                        j = evring.len;
                     }
                 }
-            }
-
-        }
-        break;
-
-        case XCB_CONFIGURE_NOTIFY:
-        {
-            xcb_configure_notify_event_t *e
-                = (xcb_configure_notify_event_t *)ev;
+                break;
+                }
+                break;
 
-            if (e->window == screen->root)
+            case XCB_PROPERTY_NOTIFY:
             {
+                xcb_property_notify_event_t *e
+                    = (xcb_property_notify_event_t *) ev;
+
                 /*
-                 * When using RANDR or Xinerama, the root can change
-                 * geometry when the user adds a new screen, tilts
-                 * their screen 90 degrees or whatnot. We might need
-                 * to rearrange windows to be visible.
-                 *
-                 * We might get notified for several reasons, not just
-                 * if the geometry changed. If the geometry is
-                 * unchanged we do nothing.
+                 * We fetch the property again anyway, so only the
+                 * last change before the window is mapped or
+                 * unmapped matters.
                  */
-                PDEBUG("Notify event for root!\n");
-                PDEBUG("Possibly a new root geometry: %dx%d\n",
-                       e->width, e->height);
-
-                if (e->width == screen->width_in_pixels
-                    && e->height == screen->height_in_pixels)
+                if ((later->response_type & ~0x80) == XCB_PROPERTY_NOTIFY
+                    && ((xcb_property_notify_event_t *) later)->window
+                    == e->window
+                    && ((xcb_property_notify_event_t *) later)->atom
+                    == e->atom)
                 {
-                    /* Root geometry is really unchanged. Do nothing. */
-                    PDEBUG("Hey! Geometry didn't change.\n");
+                    dropevent(i);
+                    j = evring.len;
                 }
-                else
+                else if (confbarrier(later, e->window))
                 {
-                    screen->width_in_pixels = e->width;
-                    screen->height_in_pixels = e->height;
+                    j = evring.len;
+                }
+            }
+            break;
 
-                    /* Check for RANDR. */
-                    if (-1 == randrbase)
-                    {
-                        /* We have no RANDR so we rearrange windows to
-                         * the new root geometry here.
-                         *
-                         * With RANDR enabled, we handle this per
-                         * screen getrandr() when we receive an
-                         * XCB_RANDR_SCREEN_CHANGE_NOTIFY event.
-                         */
-                        arrangewindows();
-                    }
+            case XCB_CONFIGURE_REQUEST:
+            {
+                xcb_configure_request_event_t *e
+                    = (xcb_configure_request_event_t *) ev;
+
+                if ((later->response_type & ~0x80) == XCB_CONFIGURE_REQUEST
+                    && ((xcb_configure_request_event_t *) later)->window
+                    == e->window)
+                {
+                    mergeconfreq(e, (xcb_configure_request_event_t *) later);
+                    dropevent(i);
+                    j = evring.len;
+                }
+                else if (confbarrier(later, e->window))
+                {
+                    j = evring.len;
                 }
             }
-        }
-        break;
+            break;
 
-        case XCB_CONFIGURE_REQUEST:
-            configurerequest((xcb_configure_request_event_t *) ev);
-        break;
+            default:
+                /* Nothing to coalesce. */
+                j = evring.len;
+                break;
+            }
+        } /* for j */
+    } /* for i */
+}
 
-        case XCB_CLIENT_MESSAGE:
-        {
-            xcb_client_message_event_t *e
-                = (xcb_client_message_event_t *)ev;
+/*
+ * Return the window event ev is about, or XCB_NONE if it isn't about a
+ * particular window.
+ */
+xcb_window_t evwindow(xcb_generic_event_t *ev)
+{
+    switch (ev->response_type & ~0x80)
+    {
+    case XCB_ENTER_NOTIFY:
+    case XCB_LEAVE_NOTIFY:
+        return ((xcb_enter_notify_event_t *) ev)->event;
 
-            if (conf.allowicons)
-            {
-                if (e->type == wm_change_state
-                    && e->format == 32
-                    && e->data.data32[0] == XCB_ICCCM_WM_STATE_ICONIC)
-                {
-                    long data[] = { XCB_ICCCM_WM_STATE_ICONIC, XCB_NONE };
+    case XCB_CREATE_NOTIFY:
+        return ((xcb_create_notify_event_t *) ev)->window;
 
-                    /* Unmap window and declare iconic. */
+    case XCB_DESTROY_NOTIFY:
+        return ((xcb_destroy_notify_event_t *) ev)->window;
 
-                    xcb_unmap_window(conn, e->window);
-                    xcb_change_property(conn, XCB_PROP_MODE_REPLACE, e->window,
-                                        wm_state, wm_state, 32, 2, data);
-                    xcb_flush(conn);
-                }
-            }
+    case XCB_UNMAP_NOTIFY:
+        return ((xcb_unmap_notify_event_t *) ev)->window;
+
+    case XCB_MAP_NOTIFY:
+        return ((xcb_map_notify_event_t *) ev)->window;
+
+    case XCB_MAP_REQUEST:
+        return ((xcb_map_request_event_t *) ev)->window;
+
+    case XCB_REPARENT_NOTIFY:
+        return ((xcb_reparent_notify_event_t *) ev)->window;
+
+    case XCB_CONFIGURE_NOTIFY:
+        return ((xcb_configure_notify_event_t *) ev)->window;
+
+    case XCB_CONFIGURE_REQUEST:
+        return ((xcb_configure_request_event_t *) ev)->window;
+
+    case XCB_CIRCULATE_REQUEST:
+        return ((xcb_circulate_request_event_t *) ev)->window;
+
+    case XCB_PROPERTY_NOTIFY:
+        return ((xcb_property_notify_event_t *) ev)->window;
+
+    case XCB_CLIENT_MESSAGE:
+        return ((xcb_client_message_event_t *) ev)->window;
+
+    default:
+        return XCB_NONE;
+    }
+}
+
+/*
+ * Drop all events about windows that are destroyed later in the
+ * ring. Handling them would only send requests that fail with
+ * BadWindow. We walk backwards, remembering the windows we've seen
+ * DestroyNotify for.
+ */
+void elidestale(void)
+{
+    xcb_window_t dead[EVRING_SIZE];
+    unsigned ndead = 0;
+    xcb_generic_event_t *ev;
+    xcb_window_t win;
+    unsigned i;
+    unsigned d;
+
+    for (i = evring.len; i-- > 0;)
+    {
+        ev = evring.ev[(evring.head + i) % EVRING_SIZE];
+        if (NULL == ev)
+        {
+            continue;
         }
-        break;
 
-        case XCB_CIRCULATE_REQUEST:
+        win = evwindow(ev);
+        if (XCB_NONE == win)
         {
-            xcb_circulate_request_event_t *e
-                = (xcb_circulate_request_event_t *)ev;
+            continue;
+        }
 
-            /*
-             * Subwindow e->window to parent e->event is about to be
-             * restacked.
-             *
-             * Just do what was requested, e->place is either
-             * XCB_PLACE_ON_TOP or _ON_BOTTOM. We don't care.
-             */
-            xcb_circulate_window(conn, e->window, e->place);
+        if ((ev->response_type & ~0x80) == XCB_DESTROY_NOTIFY)
+        {
+            dead[ndead ++] = win;
+            continue;
         }
-        break;
 
-        case XCB_MAPPING_NOTIFY:
+        for (d = 0; d < ndead; d ++)
         {
-            xcb_mapping_notify_event_t *e
-                = (xcb_mapping_notify_event_t *)ev;
+            if (dead[d] == win)
+            {
+                PDEBUG("Skipping event %d for destroyed window %d.\n",
+                       ev->response_type, win);
 
-            /*
-             * XXX Gah! We get a new notify message for *every* key!
-             * We want to know when the entire keyboard is finished.
-             * Impossible? Better handling somehow?
-             */
+                stats.stale ++;
 
-            /*
-             * We're only interested in keys and modifiers, not
-             * pointer mappings, for instance.
-             */
-            if (e->request != XCB_MAPPING_MODIFIER
-                && e->request != XCB_MAPPING_KEYBOARD)
-            {
+                free(ev);
+                evring.ev[(evring.head + i) % EVRING_SIZE] = NULL;
                 break;
             }
+        }
+    }
+}
 
-            /* Forget old key bindings. */
-            xcb_ungrab_key(conn, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
+void events(void)
+{
+    xcb_generic_event_t *ev;
+    unsigned found_events;          /* Events read this time around. */
+    bool replied;                   /* Did we handle any replies? */
 
-            /* Use the new ones. */
-            setupkeys();
-        }
-        break;
+    /*
+     * Wake up when there's something to read from the server. There's
+     * nothing to call: We read the events at the top of the loop.
+     */
+    if (-1 == addfd(xcb_get_file_descriptor(conn), NULL, NULL))
+    {
+        fprintf(stderr, "mcwm: Couldn't watch X connection.\n");
+        cleanup(0);
+        exit(1);
+    }
 
-        case XCB_UNMAP_NOTIFY:
+    for (sigcode = 0; 0 == sigcode;)
+    {
+        /*
+         * Check for events, again and again. First read everything
+         * that's waiting, drop what's been made useless by later
+         * events and handle the rest in order. Then call the
+         * callbacks for any replies that have arrived.
+         *
+         * When there's nothing to do (and that happens a lot), we
+         * block in loopwait() until the event file descriptor gets
+         * readable again, a signal arrives or a timer expires.
+         *
+         * We do it this way instead of xcb_wait_for_event() since
+         * signals and timers wake up the loop as well. We like that.
+         */
+        found_events = drainevents();
+        if (0 != found_events)
         {
-            xcb_unmap_notify_event_t *e =
-                (xcb_unmap_notify_event_t *)ev;
-            struct item *item;
-            struct client *client;
+            elidestale();
+            coalesce();
 
-            /*
-             * Find the window in our *current* workspace list, then
-             * forget about it. If it gets mapped, we add it to our
-             * lists again then.
-             *
-             * Note that we might not know about the window we got the
-             * UnmapNotify event for. It might be a window we just
-             * unmapped on *another* workspace when changing
-             * workspaces, for instance, or it might be a window with
-             * override redirect set. This is not an error.
-             *
-             * XXX We might need to look in the global window list,
-             * after all. Consider if a window is unmapped on our last
-             * workspace while changing workspaces... If we do this,
-             * we need to keep track of our own windows and ignore
-             * UnmapNotify on them.
-             */
-            for (item = wslist[curws]; item != NULL; item = item->next)
+            for (; 0 != evring.len; evring.len --)
             {
-                client = item->data;
+                ev = evring.ev[evring.head];
+                keyrepeats = evring.repeats[evring.head];
+                evring.repeats[evring.head] = 0;
+                evring.head = (evring.head + 1) % EVRING_SIZE;
 
-                if (client->id == e->window)
+                if (NULL != ev)
                 {
-                    PDEBUG("Forgetting about %d\n", e->window);
-                    if (focuswin == client)
-                    {
-                        focuswin = NULL;
-                    }
+                    stats.events ++;
+                    handleevent(ev);
 
-                    forgetclient(client);
-                    /* We're finished. Break out of for loop. */
-                    break;
+                    /* Forget about this event. */
+                    free(ev);
                 }
             }
+
+            /* Timers and replies don't come with a pointer position. */
+            pointerpos.current = false;
+
+            /* At most one move or resize per batch when dragging. */
+            applydrag();
         }
-        break;
 
+        replied = runreplies();
+
+        /*
+         * Timers only run in loopwait(), which we skip for as long
+         * as events keep coming. Run the ones that are due here so a
+         * busy server can't hold them back.
+         */
+        looptimers();
+
+        /* Send all geometry changes, one configure per window. */
+        commitall();
+
+        if (replied || 0 != found_events)
+        {
+            continue;
+        }
+
+        /*
+         * Looking for replies might have read more events from the
+         * socket. Don't go to sleep on them.
+         */
+        if (NULL != (ev = xcb_poll_for_queued_event(conn)))
+        {
+            evring.ev[evring.head] = ev;
+            evring.len = 1;
+            continue;
+        }
+
+        PDEBUG("xcb_poll_for_event() returned NULL.\n");
+
+        /*
+         * Check if we have an unrecoverable connection error, like a
+         * disconnected X server.
+         */
+        if (xcb_connection_has_error(conn))
+        {
+            cleanup(0);
+            exit(1);
         }
 
-        /* Forget about this event. */
-        free(ev);
+        /*
+         * None of the handlers flush. Everything they queued up while
+         * we were working through the events goes out here in one
+         * write, just before we go to sleep.
+         */
+        xcb_flush(conn);
+        stats.flushes ++;
+
+        /*
+         * If we received a signal sigcode is set when we come back,
+         * and we break out of the loop.
+         */
+        if (-1 == loopwait())
+        {
+            /* Something was seriously wrong with the loop. */
+            fprintf(stderr, "mcwm: Waiting for events failed.\n");
+            cleanup(0);
+            exit(1);
+        }
     }
 }
 
 void printhelp(void)
 {
     printf("mcwm: Usage: mcwm [-b] [-s snapmargin] [-t terminal-program] "
-           "[-f colour] [-u colour] [-x colour] \n");
+           "[-f colour] [-u colour] [-x colour] [-S] [-M] [-o] "
+           "[-r rate]\n");
     printf("  -b means draw no borders\n");
     printf("  -s snapmargin in pixels\n");
     printf("  -t urxvt will start urxvt when MODKEY + Return is pressed\n");
@@ -4271,36 +8367,118 @@ void printhelp(void)
            "to a named color.\n");
     printf("  -u colour sets colour for unfocused window borders.\n");
     printf("  -x color sets colour for fixed window borders.\n");
+    printf("  -S prints statistics on exit.\n");
+    printf("  -M uses pointer motion events directly when moving or "
+           "resizing.\n");
+    printf("  -o moves and resizes an outline instead of the window.\n");
+    printf("  -r rate limits windows to rate configure requests per "
+           "second.\n");
 }
 
-void sigcatch(int sig)
+void printstats(void)
 {
-    sigcode = sig;
-}
+    struct item *item;
+    struct client *client;
+    int i;
 
-/*
- * Get a defined atom from the X server.
- */
-xcb_atom_t getatom(char *atom_name)
-{
-    xcb_intern_atom_cookie_t atom_cookie;
-    xcb_atom_t atom;
-    xcb_intern_atom_reply_t *rep;
+    fprintf(stderr, "mcwm: %llu windows adopted at startup in %.3f ms.\n",
+            (unsigned long long) stats.adopted, stats.startup / 1000.0);
+    fprintf(stderr, "mcwm: %llu events handled.\n",
+            (unsigned long long) stats.events);
+    fprintf(stderr, "mcwm: %llu flushes, %.3f per event.\n",
+            (unsigned long long) stats.flushes,
+            0 == stats.events ? 0.0
+            : (double) stats.flushes / stats.events);
+    fprintf(stderr, "mcwm: %llu superseded events dropped.\n",
+            (unsigned long long) stats.coalesced);
+    fprintf(stderr, "mcwm: %llu key repeats merged into one step.\n",
+            (unsigned long long) stats.keyrepeats);
+    fprintf(stderr, "mcwm: %llu replies handled asynchronously.\n",
+            (unsigned long long) stats.replies);
+    fprintf(stderr, "mcwm: %llu events from our own requests ignored.\n",
+            (unsigned long long) stats.echoes);
+    fprintf(stderr, "mcwm: %llu events for destroyed windows skipped.\n",
+            (unsigned long long) stats.stale);
+    fprintf(stderr, "mcwm: %llu windows had all properties prefetched "
+            "when mapped.\n", (unsigned long long) stats.prefetched);
+    fprintf(stderr, "mcwm: %llu new windows never mapped in time and "
+            "forgotten.\n", (unsigned long long) stats.adoptexpired);
+    fprintf(stderr, "mcwm: %llu pointer positions known from events, "
+            "%llu queried.\n", (unsigned long long) stats.pointerhits,
+            (unsigned long long) stats.pointerqueries);
+    fprintf(stderr, "mcwm: %llu drag updates using %s, %.1f us average "
+            "latency.\n", (unsigned long long) stats.dragupdates,
+            conf.directmotion ? "motion events" : "motion hints",
+            0 == stats.dragupdates ? 0.0
+            : (double) stats.draglatency / stats.dragupdates);
+    fprintf(stderr, "mcwm: %llu sync requests, %llu timed out, %llu resizes "
+            "held back.\n", (unsigned long long) stats.syncrequests,
+            (unsigned long long) stats.synctimeouts,
+            (unsigned long long) stats.syncheld);
+    fprintf(stderr, "mcwm: %.1f drag updates per second while dragging.\n",
+            0 == stats.dragtime ? 0.0
+            : (double) stats.dragupdates * 1000000 / stats.dragtime);
+    fprintf(stderr, "mcwm: %llu configures for staged changes with %llu "
+            "values, %llu values unchanged and skipped.\n",
+            (unsigned long long) stats.commits,
+            (unsigned long long) stats.commitvalues,
+            (unsigned long long) stats.commitskipped);
+    fprintf(stderr, "mcwm: %llu border changes to what it already was "
+            "skipped.\n", (unsigned long long) stats.borderskipped);
+    fprintf(stderr, "mcwm: %llu restacks, %llu that wouldn't change anything "
+            "skipped.\n", (unsigned long long) stats.restacks,
+            (unsigned long long) stats.restackskipped);
+    fprintf(stderr, "mcwm: %llu configure requests, %llu held back from "
+            "%llu flooding windows.\n",
+            (unsigned long long) stats.confrequests,
+            (unsigned long long) stats.confheld,
+            (unsigned long long) stats.flooders);
 
-    atom_cookie = xcb_intern_atom(conn, 0, strlen(atom_name), atom_name);
-    rep = xcb_intern_atom_reply(conn, atom_cookie, NULL);
-    if (NULL != rep)
+    for (item = winlist; item != NULL; item = item->next)
     {
-        atom = rep->atom;
-        free(rep);
-        return atom;
+        client = item->data;
+
+        if (0 == client->flood.held)
+        {
+            continue;
+        }
+
+        fprintf(stderr, "mcwm:   window 0x%x (%s): %llu configure requests, "
+                "%llu held back.\n", client->id,
+                NULL == client->props.wmclass ? "?" : client->props.wmclass,
+                (unsigned long long) client->flood.total,
+                (unsigned long long) client->flood.held);
     }
 
-    /*
-     * XXX Note that we return 0 as an atom if anything goes wrong.
-     * Might become interesting.
-     */
-    return 0;
+    for (i = 0; i < 256; i ++)
+    {
+        if (0 == handlers[i].count)
+        {
+            continue;
+        }
+
+        if (NULL == handlers[i].fn)
+        {
+            fprintf(stderr, "mcwm: %-22s #%-3d %10llu unhandled.\n",
+                    "", i, (unsigned long long) handlers[i].count);
+            continue;
+        }
+
+        fprintf(stderr, "mcwm: %-22s #%-3d %10llu %12.1f us %8.2f us/event\n",
+                handlers[i].name, i,
+                (unsigned long long) handlers[i].count,
+                handlers[i].nsec / 1000.0,
+                handlers[i].nsec / 1000.0 / handlers[i].count);
+    }
+}
+
+/*
+ * Called from the main loop, not from a signal handler, when we get
+ * SIGINT or SIGTERM.
+ */
+void sigcatch(int sig, void *data)
+{
+    sigcode = sig;
 }
 
 int main(int argc, char **argv)
@@ -4314,6 +8492,13 @@ int main(int argc, char **argv)
     char *focuscol;
     char *unfocuscol;
     char *fixedcol;    
+    struct colordef colors[] =
+    {
+        { NULL, &conf.focuscol },
+        { NULL, &conf.unfocuscol },
+        { NULL, &conf.fixedcol },
+        { NULL, NULL }
+    };
     int scrno, i;
     xcb_screen_iterator_t iter;
 
@@ -4326,15 +8511,16 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    if (SIG_ERR == signal(SIGINT, sigcatch))
+    if (0 != loopinit())
     {
-        perror("mcwm: signal");
+        fprintf(stderr, "mcwm: Couldn't set up main loop. Exiting.\n");
         exit(1);
     }
 
-    if (SIG_ERR == signal(SIGTERM, sigcatch))
+    if (0 != addsignal(SIGINT, sigcatch, NULL)
+        || 0 != addsignal(SIGTERM, sigcatch, NULL))
     {
-        perror("mcwm: signal");
+        fprintf(stderr, "mcwm: Couldn't catch signals. Exiting.\n");
         exit(1);
     }
 
@@ -4344,13 +8530,17 @@ int main(int argc, char **argv)
     conf.snapmargin = SNAPMARGIN;
     conf.terminal = TERMINAL;
     conf.allowicons = ALLOWICONS;
+    conf.stats = false;
+    conf.directmotion = false;
+    conf.outline = OUTLINE;
+    conf.confrate = CONFRATE;
     focuscol = FOCUSCOL;
     unfocuscol = UNFOCUSCOL;
     fixedcol = FIXEDCOL;
 
     while (1)
     {
-        ch = getopt(argc, argv, "b:s:it:f:u:x:");
+        ch = getopt(argc, argv, "b:s:it:f:u:x:SMor:");
         if (-1 == ch)
         {
 
@@ -4390,6 +8580,22 @@ int main(int argc, char **argv)
             fixedcol = optarg;
             break;
 
+        case 'S':
+            conf.stats = true;
+            break;
+
+        case 'M':
+            conf.directmotion = true;
+            break;
+
+        case 'o':
+            conf.outline = true;
+            break;
+
+        case 'r':
+            conf.confrate = atoi(optarg);
+            break;
+
         default:
             printhelp();
             exit(0);
@@ -4428,20 +8634,25 @@ int main(int argc, char **argv)
            screen->height_in_pixels, screen->root);
 
     /* Get some colours. */
-    conf.focuscol = getcolor(focuscol);
-    conf.unfocuscol = getcolor(unfocuscol);
-    conf.fixedcol = getcolor(fixedcol);
+    visual = findvisual(screen->root_visual);
+    colors[0].name = focuscol;
+    colors[1].name = unfocuscol;
+    colors[2].name = fixedcol;
+    getcolors(colors);
+
+    setupoutline();
+
+    /* Get all atoms we need. */
+    internatoms(conn, atoms);
 
-    /* Get some atoms. */
-    atom_desktop = getatom("_NET_WM_DESKTOP");
-    wm_delete_window = getatom("WM_DELETE_WINDOW");
-    wm_change_state = getatom("WM_CHANGE_STATE");
-    wm_state = getatom("WM_STATE");
-    wm_protocols = getatom("WM_PROTOCOLS");
+    setuphandlers();
 
     /* Check for RANDR extension and configure. */
     randrbase = setuprandr();
 
+    /* Check for SYNC extension so we can resize in step with clients. */
+    syncbase = setupsync();
+
     /* Loop over all clients and set up stuff. */
     if (0 != setupscreen())
     {
@@ -4450,6 +8661,11 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+#ifdef DEBUG
+    /* Check now and then that we know where all windows are. */
+    addtimer(VERIFY_INTERVAL, verifygeom, NULL);
+#endif
+
     /* Set up key bindings. */
     if (0 != setupkeys())
     {
@@ -0,0 +1,8 @@
+/*
+ * Look up the colour name in our copy of rgb.txt. Case and spaces
+ * don't matter, just like for the server.
+ *
+ * Returns true and the colour in red, green and blue if found, false
+ * otherwise.
+ */
+bool lookuprgb(const char *name, uint8_t *red, uint8_t *green, uint8_t *blue);